@@ -56,6 +56,7 @@ struct _Displaybar {
 	 */
 	guint changed_sid;
 	guint tiles_changed_sid;
+	guint display_changed_sid;
 	guint page_changed_sid;
 };
 
@@ -113,6 +114,7 @@ displaybar_disconnect(Displaybar *displaybar)
 	if (displaybar->tilesource) {
 		FREESID(displaybar->changed_sid, displaybar->tilesource);
 		FREESID(displaybar->tiles_changed_sid, displaybar->tilesource);
+		FREESID(displaybar->display_changed_sid, displaybar->tilesource);
 		FREESID(displaybar->page_changed_sid, displaybar->tilesource);
 
 		VIPS_UNREF(displaybar->tilesource);
@@ -140,6 +142,9 @@ displaybar_imagewindow_changed(Imagewindow *win, Displaybar *displaybar)
 		displaybar->tiles_changed_sid = g_signal_connect(new_tilesource,
 			"tiles-changed",
 			G_CALLBACK(displaybar_tilesource_changed), displaybar);
+		displaybar->display_changed_sid = g_signal_connect(new_tilesource,
+			"display-changed",
+			G_CALLBACK(displaybar_tilesource_changed), displaybar);
 		displaybar->page_changed_sid = g_signal_connect(new_tilesource,
 			"page-changed",
 			G_CALLBACK(displaybar_page_changed), displaybar);
@@ -79,6 +79,12 @@ struct _Imagedisplay {
 	double scale;
 	double x, y;
 
+	/* If we're animating a zoom, the scale we will end up at and the image
+	 * point that stays fixed. A target_scale of 0 means no animation.
+	 */
+	double target_scale;
+	double target_x, target_y;
+
 	/* The size of physical display pixels in gtk coordinates, eg. for a 200%
 	 * desktop this would be 0.5.
 	 */
@@ -700,6 +706,12 @@ imagedisplay_snapshot(GtkWidget *widget, GtkSnapshot *snapshot)
 	paint.size.width = imagedisplay->paint_rect.width / pixel_size;
 	paint.size.height = imagedisplay->paint_rect.height / pixel_size;
 
+	if (imagedisplay->tilecache)
+		tilecache_set_zoom_target(imagedisplay->tilecache,
+			imagedisplay->target_scale / pixel_size,
+			imagedisplay->target_x,
+			imagedisplay->target_y);
+
 	if (imagedisplay->tilecache &&
 		imagedisplay->tilecache->n_levels > 0)
 		tilecache_snapshot(imagedisplay->tilecache, snapshot,
@@ -928,6 +940,19 @@ imagedisplay_image_to_gtk(Imagedisplay *imagedisplay,
 		imagedisplay->y + imagedisplay->paint_rect.top;
 }
 
+/* Set the zoom an animation will end at, and the image point which stays
+ * fixed, so we can fetch tiles for it early. Set zoom to 0 when the
+ * animation stops.
+ */
+void
+imagedisplay_set_zoom_target(Imagedisplay *imagedisplay,
+	double zoom, double x_image, double y_image)
+{
+	imagedisplay->target_scale = zoom;
+	imagedisplay->target_x = x_image;
+	imagedisplay->target_y = y_image;
+}
+
 void
 imagedisplay_gtk_to_image(Imagedisplay *imagedisplay,
 	double x_gtk, double y_gtk, double *x_image, double *y_image)
@@ -41,6 +41,9 @@ void imagedisplay_image_to_gtk(Imagedisplay *imagedisplay,
 void imagedisplay_gtk_to_image(Imagedisplay *imagedisplay,
 	double x_gtk, double y_gtk, double *x_image, double *y_image);
 
+void imagedisplay_set_zoom_target(Imagedisplay *imagedisplay,
+	double zoom, double x_image, double y_image);
+
 Imagedisplay *imagedisplay_new(Tilesource *tilesource);
 
 #endif /* __IMAGEDISPLAY_H */
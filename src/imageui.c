@@ -46,6 +46,11 @@
  */
 #define ZOOM_DURATION (0.5)
 
+/* During continuous zoom, fetch tiles for where we will be this many secs
+ * ahead.
+ */
+#define ZOOM_LOOKAHEAD (0.5)
+
 /* Snap if closer than this.
  */
 const int imageui_snap_threshold = 10;
@@ -422,6 +427,21 @@ ease_out_cubic(double t)
 	return p * p * p + 1;
 }
 
+/* Tell imagedisplay where a zoom animation will end up, so it can start
+ * fetching tiles early. zoom is in our units, 0 for no zoom target.
+ */
+static void
+imageui_set_zoom_target(Imageui *imageui, double zoom)
+{
+	if (zoom > 0)
+		/* Scale by the zoom factor (SVG etc. zoom) we picked on load.
+		 */
+		zoom /= imageui->tilesource->zoom;
+
+	imagedisplay_set_zoom_target(IMAGEDISPLAY(imageui->imagedisplay),
+		zoom, imageui->zoom_x, imageui->zoom_y);
+}
+
 static void
 imageui_stop_animation(Imageui *imageui)
 {
@@ -429,6 +449,7 @@ imageui_stop_animation(Imageui *imageui)
 		gtk_widget_remove_tick_callback(GTK_WIDGET(imageui),
 			imageui->tick_handler);
 		imageui->tick_handler = 0;
+		imageui_set_zoom_target(imageui, 0);
 	}
 }
 
@@ -492,6 +513,8 @@ imageui_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
 			imageui->zoom_target = 0;
 			imageui_stop_animation(imageui);
 		}
+		else
+			imageui_set_zoom_target(imageui, imageui->zoom_target);
 	}
 	else {
 		// i/o/etc. continuous zoom
@@ -499,6 +522,10 @@ imageui_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
 
 		if (imageui->zoom_rate == 1.0)
 			imageui_stop_animation(imageui);
+		else
+			// zoom grows exponentially at this rate
+			imageui_set_zoom_target(imageui, new_zoom *
+				exp((imageui->zoom_rate - 1.0) * ZOOM_LOOKAHEAD));
 	}
 
 	imageui_set_zoom_position(imageui,
@@ -87,6 +87,11 @@ struct _Imagewindow {
 	GTimer *progress_timer;
 	double last_progress_time;
 
+	/* Set while a tilesource is being made in the background. Cancel to
+	 * drop the result.
+	 */
+	GCancellable *open_cancellable;
+
 	/* The set of active images in the stack right now. These are not 
 	 * references.
 	 */
@@ -178,7 +183,9 @@ imagewindow_active_lookup_by_filename(Imagewindow *win, const char *filename)
 		Active *active = (Active *) p->data;
 		Tilesource *tilesource = imageui_get_tilesource(active->imageui);
 
+		// cancelled loads are never reused
 		if (tilesource->filename && 
+			!g_atomic_int_get(&tilesource->load_cancel) &&
 			g_str_equal(tilesource->filename, filename))
 			return active;
 	}
@@ -233,6 +240,17 @@ imagewindow_active_add(Imagewindow *win, Imageui *imageui)
 
 	imagewindow_active_touch(win, active);
 
+	// drop any images we moved off before they loaded
+	for (GSList *p = win->active; p; ) {
+		Active *cancelled = (Active *) p->data;
+		Tilesource *tilesource = imageui_get_tilesource(cancelled->imageui);
+
+		p = p->next;
+		if (cancelled->imageui != win->imageui &&
+			g_atomic_int_get(&tilesource->load_cancel))
+			imagewindow_active_remove(win, cancelled);
+	}
+
 	while (g_slist_length(win->active) > 3) {
 		Active *oldest;
 
@@ -597,6 +615,11 @@ imagewindow_tilesource_changed(Tilesource *tilesource, Imagewindow *win)
 	printf("imagewindow_tilesource_changed:\n");
 #endif /*DEBUG*/
 
+	/* We moved off this image before it loaded, and it will be dropped.
+	 */
+	if (g_atomic_int_get(&tilesource->load_cancel))
+		return;
+
 	if (tilesource->load_error)
 		imagewindow_set_error(win, tilesource->load_message);
 
@@ -773,12 +796,91 @@ imagewindow_imageui_set_visible(Imagewindow *win,
     gtk_widget_set_sensitive(win->refresh, win->n_files > 0);
 }
 
+/* An open in progress.
+ */
+typedef struct _ImagewindowOpen {
+	Imagewindow *win;
+	GtkStackTransitionType transition;
+} ImagewindowOpen;
+
+static void
+imagewindow_open_cancel(Imagewindow *win)
+{
+	if (win->open_cancellable) {
+		g_cancellable_cancel(win->open_cancellable);
+		VIPS_UNREF(win->open_cancellable);
+		gtk_action_bar_set_revealed(GTK_ACTION_BAR(win->progress_bar),
+			FALSE);
+	}
+}
+
+static void
+imagewindow_open_ready(GObject *source_object,
+	GAsyncResult *result, gpointer user_data)
+{
+	ImagewindowOpen *open = (ImagewindowOpen *) user_data;
+	Imagewindow *win = open->win;
+
+	GError *error = NULL;
+	g_autoptr(Tilesource) tilesource =
+		tilesource_new_from_file_finish(result, &error);
+
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		/* Another open has started, or the window has closed.
+		 */
+		g_error_free(error);
+	else {
+		VIPS_UNREF(win->open_cancellable);
+		gtk_action_bar_set_revealed(GTK_ACTION_BAR(win->progress_bar),
+			FALSE);
+
+		Imageui *imageui;
+		if (!tilesource)
+			imagewindow_gerror(win, &error);
+		else if (!(imageui = imageui_new(tilesource)))
+			imagewindow_error(win);
+		else {
+			imagewindow_imageui_add(win, imageui);
+			imagewindow_imageui_set_visible(win, imageui, open->transition);
+		}
+	}
+
+	g_object_unref(win);
+	g_free(open);
+}
+
+/* Make the tilesource in the background. The current image stays up, with
+ * a progress bar, until the new one is ready.
+ */
+static void
+imagewindow_open_start(Imagewindow *win, const char *filename,
+	GtkStackTransitionType transition)
+{
+	ImagewindowOpen *open = g_new0(ImagewindowOpen, 1);
+	open->win = g_object_ref(win);
+	open->transition = transition;
+
+	win->open_cancellable = g_cancellable_new();
+
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(win->progress),
+		_("Opening ..."));
+	gtk_progress_bar_pulse(GTK_PROGRESS_BAR(win->progress));
+	gtk_action_bar_set_revealed(GTK_ACTION_BAR(win->progress_bar), TRUE);
+
+	tilesource_new_from_file_async(filename, win->open_cancellable,
+		imagewindow_open_ready, open);
+}
+
 static void
 imagewindow_open_current_file(Imagewindow *win,
 	GtkStackTransitionType transition)
 {
 	imagewindow_error_hide(win);
 
+	/* Any open in progress is out of date.
+	 */
+	imagewindow_open_cancel(win);
+
 	if (!win->files)
 		imagewindow_imageui_set_visible(win, NULL, transition);
 	else {
@@ -807,20 +909,8 @@ imagewindow_open_current_file(Imagewindow *win,
 				imagewindow_error( win );
 			 */
 
-			g_autoptr(Tilesource) tilesource =
-				tilesource_new_from_file(filename);
-			if (!tilesource) {
-				imagewindow_error(win);
-				return;
-			}
-
-			imageui = imageui_new(tilesource);
-			if (!imageui) {
-				imagewindow_error(win);
-				return;
-			}
-
-			imagewindow_imageui_add(win, imageui);
+			imagewindow_open_start(win, filename, transition);
+			return;
 		}
 
 		imagewindow_imageui_set_visible(win, imageui, transition);
@@ -837,6 +927,10 @@ imagewindow_dispose(GObject *object)
 #endif /*DEBUG*/
 
 	imagewindow_files_free(win);
+	if (win->open_cancellable) {
+		g_cancellable_cancel(win->open_cancellable);
+		VIPS_UNREF(win->open_cancellable);
+	}
 
 	VIPS_UNREF(win->save_folder);
 	VIPS_UNREF(win->load_folder);
@@ -1256,9 +1350,9 @@ imagewindow_info(GSimpleAction *action,
 	g_simple_action_set_state(action, state);
 }
 
-// is an image being background-loaded?
-static gboolean
-imagewindow_loading(Imagewindow *win)
+// if the image is still being background-loaded, stop the load
+static void
+imagewindow_load_cancel(Imagewindow *win)
 {
 	Tilesource *tilesource = imagewindow_get_tilesource(win);
 
@@ -1266,10 +1360,9 @@ imagewindow_loading(Imagewindow *win)
 		gboolean loaded;
 
 		g_object_get(tilesource, "loaded", &loaded, NULL);
-		return !loaded;
+		if (!loaded)
+			tilesource_cancel_load(tilesource);
 	}
-
-	return FALSE;
 }
 
 static void
@@ -1278,10 +1371,9 @@ imagewindow_next_image(GSimpleAction *action,
 {
 	Imagewindow *win = IMAGEWINDOW(user_data);
 
-	// if there's a background load active, do nothing
-	// we want to prevent many bg loads queueing up
-	if (imagewindow_loading(win)) 
-		return;
+	// stop any background load, so loads don't pile up ... an open that's
+	// still sniffing is cancelled by the next one instead
+	imagewindow_load_cancel(win);
 
 	if (win->n_files > 0) {
 		win->current_file = (win->current_file + 1) % win->n_files;
@@ -1296,10 +1388,9 @@ imagewindow_prev_image(GSimpleAction *action,
 {
 	Imagewindow *win = IMAGEWINDOW(user_data);
 
-	// if there's a background load active, then do nothing
-	// we want to prevent many bg loads queueing up
-	if (imagewindow_loading(win))
-		return;
+	// stop any background load, so loads don't pile up ... an open that's
+	// still sniffing is cancelled by the next one instead
+	imagewindow_load_cancel(win);
 
 	if (win->n_files > 0) {
 		win->current_file = (win->current_file + win->n_files - 1) %
@@ -29,6 +29,14 @@
 
 #include "vipsdisp.h"
 
+#ifdef HAVE_F16C
+#include <immintrin.h>
+#endif /*HAVE_F16C*/
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /*__SSE2__*/
+
 /*
 #define DEBUG_VERBOSE
 #define DEBUG
@@ -38,8 +46,77 @@
  */
 static int tile_ticks = 0;
 
+/* Total bytes of pixel memory held by all tiles in the process.
+ */
+static gsize tile_memory = 0;
+
+/* The LRU list of all tiles in the process.
+ */
+static Tile *tile_lru_head = NULL;
+static Tile *tile_lru_tail = NULL;
+
+/* The largest pixel we make textures from, in bytes.
+ */
+#define TILE_MAX_BPP (8)
+
+/* Full tiles get their pixels from a pool of recycled buffers, with a free
+ * list for each pixel size. Each buffer starts with a header recording the
+ * pixel size and, while it's spare, the next buffer on the list. Textures
+ * can be freed from any thread, so this needs a lock.
+ */
+typedef struct _TileBuffer {
+	struct _TileBuffer *next;
+	int bpp;
+} TileBuffer;
+
+/* Keep the pixels after the header nicely aligned.
+ */
+#define TILE_BUFFER_HEADER (16)
+
+G_LOCK_DEFINE_STATIC(tile_pool);
+static TileBuffer *tile_pool[TILE_MAX_BPP + 1] = { NULL };
+static gsize tile_pool_bytes = 0;
+static gsize tile_pool_limit = TILECACHE_MEMORY_DEFAULT / TILE_POOL_FRACTION;
+
+#ifdef DEBUG
+static int tile_pool_hits = 0;
+static int tile_pool_misses = 0;
+#endif /*DEBUG*/
+
 G_DEFINE_TYPE(Tile, tile, G_TYPE_OBJECT);
 
+static void
+tile_lru_unlink(Tile *tile)
+{
+	if (tile->lru_prev)
+		tile->lru_prev->lru_next = tile->lru_next;
+	else if (tile_lru_head == tile)
+		tile_lru_head = tile->lru_next;
+	else
+		// not on the list
+		return;
+
+	if (tile->lru_next)
+		tile->lru_next->lru_prev = tile->lru_prev;
+	else
+		tile_lru_tail = tile->lru_prev;
+
+	tile->lru_prev = NULL;
+	tile->lru_next = NULL;
+}
+
+static void
+tile_lru_append(Tile *tile)
+{
+	tile->lru_prev = tile_lru_tail;
+	tile->lru_next = NULL;
+	if (tile_lru_tail)
+		tile_lru_tail->lru_next = tile;
+	else
+		tile_lru_head = tile;
+	tile_lru_tail = tile;
+}
+
 static void
 tile_dispose(GObject *object)
 {
@@ -49,8 +126,14 @@ tile_dispose(GObject *object)
 	printf("tile_dispose: %p\n", object);
 #endif /*DEBUG*/
 
+	tile_lru_unlink(tile);
+
+	tile_memory -= tile->size;
+	tile->size = 0;
 	VIPS_UNREF(tile->texture);
-	VIPS_FREEF(g_bytes_unref, tile->bytes);
+	for (int i = 0; i < tile->n_generations; i++)
+		VIPS_UNREF(tile->generations[i].texture);
+	tile->n_generations = 0;
 
 	G_OBJECT_CLASS(tile_parent_class)->dispose(object);
 }
@@ -68,6 +151,123 @@ tile_class_init(TileClass *class)
 	gobject_class->dispose = tile_dispose;
 }
 
+/* Get a buffer for a full tile of pixels, from the pool if we can.
+ */
+static VipsPel *
+tile_buffer_new(int bpp)
+{
+	gsize size = TILE_SIZE * TILE_SIZE * bpp;
+	TileBuffer *buf;
+
+	g_assert(bpp > 0 && bpp <= TILE_MAX_BPP);
+
+	G_LOCK(tile_pool);
+	if ((buf = tile_pool[bpp])) {
+		tile_pool[bpp] = buf->next;
+		tile_pool_bytes -= size;
+	}
+	G_UNLOCK(tile_pool);
+
+#ifdef DEBUG
+	if (buf)
+		g_atomic_int_inc(&tile_pool_hits);
+	else
+		g_atomic_int_inc(&tile_pool_misses);
+
+	int hits = g_atomic_int_get(&tile_pool_hits);
+	int misses = g_atomic_int_get(&tile_pool_misses);
+	if ((hits + misses) % 1000 == 0)
+		printf("tile_buffer_new: %d hits, %d misses, %.1f%% hit rate, "
+			   "%zd bytes spare\n",
+			hits, misses, 100.0 * hits / (hits + misses), tile_pool_bytes);
+#endif /*DEBUG*/
+
+	if (!buf) {
+		buf = g_malloc(TILE_BUFFER_HEADER + size);
+		buf->bpp = bpp;
+	}
+
+	return (VipsPel *) buf + TILE_BUFFER_HEADER;
+}
+
+/* The GBytes free func for full tiles. Back to the pool, unless the pool
+ * is full.
+ */
+static void
+tile_buffer_free(void *data)
+{
+	TileBuffer *buf = (TileBuffer *) ((VipsPel *) data - TILE_BUFFER_HEADER);
+	gsize size = TILE_SIZE * TILE_SIZE * buf->bpp;
+
+	G_LOCK(tile_pool);
+	if (tile_pool_bytes + size <= tile_pool_limit) {
+		buf->next = tile_pool[buf->bpp];
+		tile_pool[buf->bpp] = buf;
+		tile_pool_bytes += size;
+		buf = NULL;
+	}
+	G_UNLOCK(tile_pool);
+
+	g_free(buf);
+}
+
+/* Set the number of bytes of spare buffers we keep, and free any excess.
+ */
+void
+tile_set_pool_limit(gsize limit)
+{
+	TileBuffer *excess = NULL;
+
+	G_LOCK(tile_pool);
+	tile_pool_limit = limit;
+	for (int bpp = TILE_MAX_BPP; bpp > 0; bpp--)
+		while (tile_pool_bytes > tile_pool_limit &&
+			tile_pool[bpp]) {
+			TileBuffer *buf = tile_pool[bpp];
+
+			tile_pool[bpp] = buf->next;
+			tile_pool_bytes -= TILE_SIZE * TILE_SIZE * bpp;
+
+			buf->next = excess;
+			excess = buf;
+		}
+	G_UNLOCK(tile_pool);
+
+	while (excess) {
+		TileBuffer *next = excess->next;
+
+		g_free(excess);
+		excess = next;
+	}
+}
+
+/* Bytes per pixel for the texture formats we make.
+ */
+static int
+tile_format_sizeof(GdkMemoryFormat format)
+{
+	switch (format) {
+	case GDK_MEMORY_G8:
+		return 1;
+
+	case GDK_MEMORY_G8A8:
+	case GDK_MEMORY_G8A8_PREMULTIPLIED:
+		return 2;
+
+	case GDK_MEMORY_R8G8B8:
+		return 3;
+
+	case GDK_MEMORY_R16G16B16_FLOAT:
+		return 6;
+
+	case GDK_MEMORY_R16G16B16A16_FLOAT_PREMULTIPLIED:
+		return 8;
+
+	default:
+		return 4;
+	}
+}
+
 /* Get the current time ... handy for mark-sweep.
  */
 int
@@ -76,6 +276,31 @@ tile_get_time(void)
 	return tile_ticks;
 }
 
+/* Bytes of pixel memory held by all tiles.
+ */
+gsize
+tile_get_memory(void)
+{
+	return tile_memory;
+}
+
+/* Bytes of pixel memory held by this tile.
+ */
+gsize
+tile_get_size(Tile *tile)
+{
+	return tile->size;
+}
+
+/* The least recently used tile. Follow ->lru_next for more recently used
+ * tiles.
+ */
+Tile *
+tile_get_lru(void)
+{
+	return tile_lru_head;
+}
+
 /* The pixels in the region have changed. We must regenerate the texture on
  * next use.
  */
@@ -83,14 +308,152 @@ void
 tile_invalidate(Tile *tile)
 {
 	tile->valid = FALSE;
+	tile->serial += 1;
 }
 
-/* Update the timestamp on a tile.
+/* Update the timestamp on a tile and move it to the most recently used end
+ * of the LRU.
  */
 void
 tile_touch(Tile *tile)
 {
 	tile->time = tile_ticks++;
+
+	if (tile != tile_lru_tail) {
+		tile_lru_unlink(tile);
+		tile_lru_append(tile);
+	}
+}
+
+static gsize
+tile_texture_sizeof(GdkTexture *texture)
+{
+	return tile_format_sizeof(gdk_texture_get_format(texture)) *
+		gdk_texture_get_width(texture) * gdk_texture_get_height(texture);
+}
+
+/* Recalculate the pixel memory held by the tile. A stale texture can also
+ * be the most recent generation, so only count it once.
+ */
+static void
+tile_update_size(Tile *tile)
+{
+	gsize size;
+
+	size = tile->texture ? tile_texture_sizeof(tile->texture) : 0;
+	for (int i = 0; i < tile->n_generations; i++)
+		if (tile->generations[i].texture != tile->texture)
+			size += tile_texture_sizeof(tile->generations[i].texture);
+
+	tile_memory -= tile->size;
+	tile->size = size;
+	tile_memory += tile->size;
+}
+
+/* Remove a generation, returning its texture ref to the caller.
+ */
+static TileGeneration
+tile_generation_remove(Tile *tile, int i)
+{
+	TileGeneration generation = tile->generations[i];
+
+	memmove(&tile->generations[i], &tile->generations[i + 1],
+		(tile->n_generations - i - 1) * sizeof(TileGeneration));
+	tile->n_generations -= 1;
+
+	return generation;
+}
+
+static gboolean
+tile_display_equal(TileDisplay *a, TileDisplay *b)
+{
+	return memcmp(a, b, sizeof(TileDisplay)) == 0;
+}
+
+static int
+tile_generation_find(Tile *tile, TileDisplay *display)
+{
+	for (int i = 0; i < tile->n_generations; i++)
+		if (tile_display_equal(&tile->generations[i].display, display))
+			return i;
+
+	return -1;
+}
+
+/* The display settings have changed. Save the current texture, if it's
+ * valid, and swap back in any texture we have for the new settings.
+ * Otherwise the tile is invalidated, and the old texture is kept to paint
+ * with until a new one arrives.
+ */
+void
+tile_set_display(Tile *tile, TileDisplay *display)
+{
+	int i;
+
+	if (!tile_display_equal(&tile->display, display) &&
+		tile->valid &&
+		tile->texture) {
+		TileGeneration generation;
+
+		if ((i = tile_generation_find(tile, &tile->display)) >= 0) {
+			generation = tile_generation_remove(tile, i);
+			VIPS_UNREF(generation.texture);
+		}
+		if (tile->n_generations == TILE_GENERATIONS) {
+			generation = tile_generation_remove(tile, TILE_GENERATIONS - 1);
+			VIPS_UNREF(generation.texture);
+		}
+
+		memmove(&tile->generations[1], &tile->generations[0],
+			tile->n_generations * sizeof(TileGeneration));
+		tile->generations[0].display = tile->display;
+		tile->generations[0].texture = g_object_ref(tile->texture);
+		tile->generations[0].scale = tile->scale;
+		tile->generations[0].offset = tile->offset;
+		tile->n_generations += 1;
+	}
+
+	tile_invalidate(tile);
+
+	if (!tile_display_equal(&tile->display, display)) {
+		tile->display = *display;
+
+		if ((i = tile_generation_find(tile, display)) >= 0) {
+			TileGeneration generation = tile_generation_remove(tile, i);
+
+			VIPS_UNREF(tile->texture);
+			tile->texture = generation.texture;
+			tile->scale = generation.scale;
+			tile->offset = generation.offset;
+			tile->valid = TRUE;
+		}
+	}
+
+	tile_update_size(tile);
+}
+
+/* The pixels have changed, so saved textures are no longer useful.
+ */
+void
+tile_clear_generations(Tile *tile)
+{
+	for (int i = 0; i < tile->n_generations; i++)
+		VIPS_UNREF(tile->generations[i].texture);
+	tile->n_generations = 0;
+
+	tile_update_size(tile);
+}
+
+/* The tilecache has dropped the tile. A pack in flight may keep it alive
+ * for a while, so take it off the LRU and forget the cache, or trimming could
+ * find it again.
+ */
+void
+tile_detach(Tile *tile)
+{
+	tile_lru_unlink(tile);
+	tile->tilecache = NULL;
+	tile->visible = FALSE;
 }
 
 /* Make a tile on an image. left/top are in level0 coordinates.
@@ -110,58 +473,367 @@ tile_new(int left, int top, int z)
 	tile->bounds0.width = TILE_SIZE << z;
 	tile->bounds0.height = TILE_SIZE << z;
 	tile->valid = FALSE;
+	tile->serial = 1;
+	tile->scale = 1.0;
 
 	tile_touch(tile);
 
 	return g_steal_pointer(&tile);
 }
 
-/* Set the texture from the pixels in a VipsRegion. The region can be less
- * than TILE_SIZE x TILE_SIZE for edge tiles, and can be RGB or RGBA (we
- * always make full size RGBA textures).
+/* TRUE if every alpha in the region is 255, or 1.0 for float tiles.
  */
-void
-tile_set_texture(Tile *tile, VipsRegion *region)
-{
-	g_assert(region->valid.left == tile->bounds.left);
-	g_assert(region->valid.top == tile->bounds.top);
-	g_assert(region->valid.width <= tile->bounds.width);
-	g_assert(region->valid.height <= tile->bounds.height);
-	g_assert(region->im->Bands == 3 || region->im->Bands == 4);
-	g_assert(region->im->BandFmt == VIPS_FORMAT_UCHAR);
-	g_assert(region->im->Type == VIPS_INTERPRETATION_sRGB);
-
-	// textures are immutable, we we must always reallocate, we can't update
-	VIPS_FREEF(g_bytes_unref, tile->bytes);
-	VIPS_UNREF(tile->texture);
-
-	// always a full tile of RGBA pixels
-	gsize length = TILE_SIZE * TILE_SIZE * 4;
-	unsigned char *data = g_malloc0(length);
+static gboolean
+tile_region_opaque(VipsRegion *region)
+{
+	int bands = region->im->Bands;
+	int n = region->valid.width * bands;
 
 	for (int y = 0; y < region->valid.height; y++) {
 		VipsPel *p =
 			VIPS_REGION_ADDR(region, region->valid.left, region->valid.top + y);
-		VipsPel *q = data + 4 * TILE_SIZE * y;
 
-		if (region->im->Bands == 4)
-			memcpy(q, p, VIPS_REGION_SIZEOF_LINE(region));
+		if (region->im->BandFmt == VIPS_FORMAT_FLOAT) {
+			float *f = (float *) p;
+
+			for (int x = bands - 1; x < n; x += bands)
+				if (f[x] != 1.0)
+					return FALSE;
+		}
 		else
-			// RGB to RGBA
-			for (int x = 0; x < region->valid.width; x++) {
-				q[0] = p[0];
-				q[1] = p[1];
-				q[2] = p[2];
-				q[3] = 255;
-
-				q += 4;
-				p += 3;
+			for (int x = bands - 1; x < n; x += bands)
+				if (p[x] != 255)
+					return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Round a float to the nearest half float.
+ */
+static guint16
+tile_float_to_half(float f)
+{
+	union {
+		float f;
+		guint32 u;
+	} v = { f };
+	guint32 sign = (v.u >> 16) & 0x8000;
+	guint32 abs = v.u & 0x7fffffff;
+	guint32 h;
+	guint32 rem;
+	guint32 half;
+
+	if (abs >= 0x7f800000)
+		// inf or nan
+		return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+	else if (abs >= 0x477ff000)
+		// too large, round to inf
+		return sign | 0x7c00;
+	else if (abs >= 0x38800000) {
+		// normal ... rebias the exponent and round to nearest even
+		h = (abs - 0x38000000) >> 13;
+		rem = abs & 0x1fff;
+		half = 0x1000;
+	}
+	else if (abs >= 0x33000000) {
+		// subnormal ... shift the mantissa and implicit bit down
+		int shift = 126 - (abs >> 23);
+		guint32 m = (abs & 0x7fffff) | 0x800000;
+
+		h = m >> shift;
+		rem = m & ((1u << shift) - 1);
+		half = 1u << (shift - 1);
+	}
+	else
+		return sign;
+
+	if (rem > half ||
+		(rem == half && (h & 1)))
+		h += 1;
+
+	return sign | h;
+}
+
+static void
+tile_half_line_scalar(guint16 *q, float *p, int n)
+{
+	for (int i = 0; i < n; i++)
+		q[i] = tile_float_to_half(p[i]);
+}
+
+#ifdef HAVE_F16C
+/* Eight floats at a time, rounding to nearest even, like
+ * tile_float_to_half().
+ */
+__attribute__((target("avx,f16c"))) static void
+tile_half_line_f16c(guint16 *q, float *p, int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256 f = _mm256_loadu_ps(p + i);
+		__m128i h = _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT);
+
+		_mm_storeu_si128((__m128i *) (q + i), h);
+	}
+
+	tile_half_line_scalar(q + i, p + i, n - i);
+}
+#endif /*HAVE_F16C*/
+
+/* Convert n floats to half floats, with F16C if this CPU has it.
+ */
+static void
+tile_half_line(guint16 *q, float *p, int n)
+{
+#ifdef HAVE_F16C
+	static gsize have_f16c = 0;
+
+	if (g_once_init_enter(&have_f16c)) {
+		__builtin_cpu_init();
+		g_once_init_leave(&have_f16c,
+			__builtin_cpu_supports("avx") &&
+					__builtin_cpu_supports("f16c") ?
+				2 : 1);
+	}
+
+	if (have_f16c == 2) {
+		tile_half_line_f16c(q, p, n);
+		return;
+	}
+#endif /*HAVE_F16C*/
+
+	tile_half_line_scalar(q, p, n);
+}
+
+/* Pack a line of float pixels as half float RGB or RGBA. Mono is spread
+ * to RGB, since there are no one-band float formats. Alpha is dropped if
+ * the tile is opaque, or premultiplied if it's not.
+ *
+ * We lay out the float line first, then convert it all in one go.
+ */
+static void
+tile_pack_line_float(guint16 *q, float *p,
+	int width, int bands, gboolean opaque)
+{
+	gboolean has_alpha = bands == 2 || bands == 4;
+	int colour = has_alpha ? bands - 1 : bands;
+	gboolean premultiply = has_alpha && !opaque;
+	int out_bands = premultiply ? 4 : 3;
+
+	float line[TILE_SIZE * 4];
+	float *r;
+
+	// RGB is already in the right layout
+	if (bands == 3) {
+		tile_half_line(q, p, width * 3);
+		return;
+	}
+
+	r = line;
+	for (int x = 0; x < width; x++) {
+		float alpha = premultiply ? p[colour] : 1.0;
+
+		for (int b = 0; b < 3; b++)
+			r[b] = p[colour == 1 ? 0 : b] * alpha;
+		if (premultiply)
+			r[3] = alpha;
+
+		r += out_bands;
+		p += bands;
+	}
+
+	tile_half_line(q, line, width * out_bands);
+}
+
+#ifdef __SSE2__
+/* Premultiply 16 bytes of mono plus alpha or RGBA, so four or eight
+ * pixels, at a time. SSE2 is part of x86-64, so there's no runtime check.
+ *
+ * Pixels are widened to 16 bits and each alpha is copied across its pixel.
+ * For t = p * alpha + 127, (t + 1 + (t >> 8)) >> 8 is exactly t / 255, so
+ * this matches the scalar loop bit for bit. Returns the number of pixels
+ * done.
+ */
+static int
+tile_premultiply_sse2(VipsPel *q, VipsPel *p, int width, int bands)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(127);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i alpha_mask = bands == 4 ?
+		_mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0) :
+		_mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+	int step = 16 / bands;
+
+	int x;
+
+	for (x = 0; x + step <= width; x += step) {
+		__m128i in = _mm_loadu_si128((__m128i *) (p + x * bands));
+		__m128i half[2] = {
+			_mm_unpacklo_epi8(in, zero),
+			_mm_unpackhi_epi8(in, zero)
+		};
+
+		for (int i = 0; i < 2; i++) {
+			__m128i alpha;
+
+			if (bands == 4) {
+				alpha = _mm_shufflelo_epi16(half[i], _MM_SHUFFLE(3, 3, 3, 3));
+				alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+			}
+			else {
+				alpha = _mm_shufflelo_epi16(half[i], _MM_SHUFFLE(3, 3, 1, 1));
+				alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 1, 1));
 			}
+
+			__m128i t = _mm_add_epi16(_mm_mullo_epi16(half[i], alpha), round);
+			t = _mm_add_epi16(t, _mm_add_epi16(one, _mm_srli_epi16(t, 8)));
+			t = _mm_srli_epi16(t, 8);
+
+			half[i] = _mm_or_si128(_mm_andnot_si128(alpha_mask, t),
+				_mm_and_si128(alpha_mask, half[i]));
+		}
+
+		_mm_storeu_si128((__m128i *) (q + x * bands),
+			_mm_packus_epi16(half[0], half[1]));
 	}
 
-	tile->bytes = g_bytes_new_take(data, length);
-	tile->texture = gdk_memory_texture_new(TILE_SIZE, TILE_SIZE,
-		GDK_MEMORY_R8G8B8A8, tile->bytes, 4 * TILE_SIZE);
+	return x;
+}
+#endif /*__SSE2__*/
+
+/* Pack a line of pixels, dropping alpha if the tile is opaque, or
+ * premultiplying if it's not.
+ */
+static void
+tile_pack_line(VipsPel *q, VipsPel *p, int width, int bands, gboolean opaque)
+{
+	int colour = bands - 1;
+
+	if (opaque)
+		for (int x = 0; x < width; x++) {
+			for (int b = 0; b < colour; b++)
+				q[b] = p[b];
+
+			q += colour;
+			p += bands;
+		}
+	else {
+		int x = 0;
+
+#ifdef __SSE2__
+		x = tile_premultiply_sse2(q, p, width, bands);
+		q += x * bands;
+		p += x * bands;
+#endif /*__SSE2__*/
+
+		for (; x < width; x++) {
+			int alpha = p[colour];
+
+			for (int b = 0; b < colour; b++)
+				q[b] = (p[b] * alpha + 127) / 255;
+			q[colour] = alpha;
+
+			q += bands;
+			p += bands;
+		}
+	}
+}
+
+/* Pack the pixels in a VipsRegion into a texture. The texture is the size
+ * of the region, so it can be less than TILE_SIZE x TILE_SIZE for edge
+ * tiles, and uses the region's pixel format directly (mono, mono plus alpha,
+ * RGB or RGBA). Float regions become half float RGB or RGBA.
+ *
+ * If all the alpha is 255 we drop it, so opaque tiles upload with no alpha
+ * and the renderer need not blend them. Other tiles are premultiplied.
+ *
+ * This touches no tile state, so it's safe to call from a worker thread.
+ */
+GdkTexture *
+tile_texture_new(VipsRegion *region)
+{
+	static const GdkMemoryFormat formats[] = {
+		GDK_MEMORY_G8,
+		GDK_MEMORY_G8A8_PREMULTIPLIED,
+		GDK_MEMORY_R8G8B8,
+		GDK_MEMORY_R8G8B8A8_PREMULTIPLIED
+	};
+
+	int bands = region->im->Bands;
+	int width = region->valid.width;
+	int height = region->valid.height;
+
+	g_assert(width <= TILE_SIZE);
+	g_assert(height <= TILE_SIZE);
+	g_assert(bands >= 1 && bands <= 4);
+	g_assert(region->im->BandFmt == VIPS_FORMAT_UCHAR ||
+		region->im->BandFmt == VIPS_FORMAT_FLOAT);
+
+	gboolean is_float = region->im->BandFmt == VIPS_FORMAT_FLOAT;
+	gboolean has_alpha = bands == 2 || bands == 4;
+	gboolean opaque = has_alpha && tile_region_opaque(region);
+
+	int out_bands;
+	GdkMemoryFormat format;
+	int bpp;
+	if (is_float) {
+		out_bands = has_alpha && !opaque ? 4 : 3;
+		format = out_bands == 4 ?
+			GDK_MEMORY_R16G16B16A16_FLOAT_PREMULTIPLIED :
+			GDK_MEMORY_R16G16B16_FLOAT;
+		bpp = out_bands * sizeof(guint16);
+	}
+	else {
+		out_bands = opaque ? bands - 1 : bands;
+		format = formats[out_bands - 1];
+		bpp = out_bands;
+	}
+
+	gsize stride = width * bpp;
+	gsize length = stride * height;
+	gboolean full = width == TILE_SIZE && height == TILE_SIZE;
+
+	// full tiles come from the pool, edge tiles are one-offs
+	VipsPel *data = full ? tile_buffer_new(bpp) : g_malloc(length);
+
+	for (int y = 0; y < height; y++) {
+		VipsPel *p =
+			VIPS_REGION_ADDR(region, region->valid.left, region->valid.top + y);
+		VipsPel *q = data + stride * y;
+
+		if (is_float)
+			tile_pack_line_float((guint16 *) q, (float *) p,
+				width, bands, opaque);
+		else if (has_alpha)
+			tile_pack_line(q, p, width, bands, opaque);
+		else
+			memcpy(q, p, stride);
+	}
+
+	g_autoptr(GBytes) bytes = full ?
+		g_bytes_new_with_free_func(data, length, tile_buffer_free, data) :
+		g_bytes_new_take(data, length);
+
+	return gdk_memory_texture_new(width, height, format, bytes, stride);
+}
+
+/* Swap in a texture made by tile_texture_new(), plus the display scale and
+ * offset it was made with. Textures are immutable, so we always replace, we
+ * can't update. Main thread only.
+ */
+void
+tile_set_texture(Tile *tile, GdkTexture *texture,
+	double scale, double offset)
+{
+	VIPS_UNREF(tile->texture);
+
+	tile->texture = g_object_ref(texture);
+	tile->scale = scale;
+	tile->offset = offset;
+	tile_update_size(tile);
 
 	tile->valid = TRUE;
 	tile_touch(tile);
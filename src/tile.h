@@ -42,6 +42,34 @@
 #define TILE_GET_CLASS(obj) \
 	(G_TYPE_INSTANCE_GET_CLASS((obj), TYPE_TILE, TileClass))
 
+/* Keep textures for this many previous display settings per tile.
+ */
+#define TILE_GENERATIONS (4)
+
+/* The display settings baked into a texture, see tilesource_get_display().
+ * Compared with memcmp(), so zero the whole struct before filling it in.
+ */
+typedef struct _TileDisplay {
+	int mode;
+	int page;
+	gboolean active;
+	gboolean falsecolour;
+	gboolean icc;
+	gboolean log;
+	double scale;
+	double offset;
+} TileDisplay;
+
+/* A texture made for some other display settings, kept so we can switch
+ * back without recomputing.
+ */
+typedef struct _TileGeneration {
+	TileDisplay display;
+	GdkTexture *texture;
+	double scale;
+	double offset;
+} TileGeneration;
+
 typedef struct _Tile {
 	GObject parent_instance;
 
@@ -49,6 +77,26 @@ typedef struct _Tile {
 	 */
 	guint time;
 
+	/* All tiles are on a single LRU list, least recently used at the head.
+	 * tile_touch() moves a tile to the tail.
+	 */
+	struct _Tile *lru_prev;
+	struct _Tile *lru_next;
+
+	/* The tilecache holding this tile.
+	 */
+	struct _Tilecache *tilecache;
+
+	/* TRUE if the tile is in the visible set of its tilecache.
+	 */
+	gboolean visible;
+
+	/* TRUE if the tile was requested by prefetch, and TRUE once the tile
+	 * has been on screen. Used to count prefetch hits and misses.
+	 */
+	gboolean prefetch;
+	gboolean shown;
+
 	/* The z layer the tile sits at.
 	 */
 	int z;
@@ -62,8 +110,29 @@ typedef struct _Tile {
 	 */
 	gboolean valid;
 
-	GBytes *bytes;
-    GdkTexture *texture;
+	/* Bumped on every invalidate. A texture packed in the background is
+	 * only swapped in if the serial hasn't changed since the pack was
+	 * queued. pack_serial is the serial of the pack in flight, or 0.
+	 */
+	guint serial;
+	guint pack_serial;
+
+	/* The display scale and offset the texture was made with.
+	 */
+	double scale;
+	double offset;
+
+	/* The display settings the texture is for, and textures for previous
+	 * settings, most recent first.
+	 */
+	TileDisplay display;
+	TileGeneration generations[TILE_GENERATIONS];
+	int n_generations;
+
+	/* Bytes of pixel memory held by the texture and any generations.
+	 */
+	gsize size;
+	GdkTexture *texture;
 } Tile;
 
 typedef struct _TileClass {
@@ -75,17 +144,33 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(Tile, g_object_unref)
 
 GType tile_get_type(void);
 
+/* Keep spare texture buffers up to this fraction of the tile memory limit.
+ */
+#define TILE_POOL_FRACTION (8)
+
 int tile_get_time(void);
+gsize tile_get_memory(void);
+gsize tile_get_size(Tile *tile);
+Tile *tile_get_lru(void);
+void tile_set_pool_limit(gsize limit);
 void tile_invalidate(Tile *tile);
 void tile_touch(Tile *tile);
+void tile_set_display(Tile *tile, TileDisplay *display);
+void tile_clear_generations(Tile *tile);
+void tile_detach(Tile *tile);
 
 /* Make a new tile on the level. left and top are in level0 coordinates.
  */
 Tile *tile_new(int left, int top, int z);
 
-/* Set the texture from the data on a region.
+/* Pack the data on a region into a texture. Safe from any thread.
+ */
+GdkTexture *tile_texture_new(VipsRegion *region);
+
+/* Swap in a new texture and mark the tile valid.
  */
-void tile_set_texture(Tile *tile, VipsRegion *region);
+void tile_set_texture(Tile *tile, GdkTexture *texture,
+	double scale, double offset);
 
 /* texture lifetime run by tile ... don't unref.
  */
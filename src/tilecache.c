@@ -40,6 +40,8 @@ enum {
 	 */
 	PROP_BACKGROUND = 1,
 	PROP_TILESOURCE,
+	PROP_PREFETCH_HITS,
+	PROP_PREFETCH_MISSES,
 
 	/* Signals.
 	 */
@@ -54,18 +56,120 @@ static guint tilecache_signals[SIG_LAST] = { 0 };
 
 G_DEFINE_TYPE(Tilecache, tilecache, G_TYPE_OBJECT);
 
+/* Tiles with no pixels which haven't been used for this many tile touches,
+ * a few frames of a full screen of tiles, are freed by trim.
+ */
+#define TILECACHE_EMPTY_AGE (1000)
+
+/* All the tilecaches in the process. They share a single memory budget.
+ */
+static GSList *tilecache_all = NULL;
+
+/* Max bytes of tile pixels we keep, summed over all tilecaches.
+ */
+static gsize tilecache_memory_limit = TILECACHE_MEMORY_DEFAULT;
+
+/* Prefetch this many tiles around the viewport.
+ */
+static int tilecache_prefetch_margin = TILECACHE_PREFETCH_DEFAULT;
+
+/* Tiles are indexed by column and row within their level. Levels can't be
+ * more than VIPS_MAX_COORD / TILE_SIZE tiles across, so 16 bits for each is
+ * plenty.
+ */
+static gpointer
+tilecache_key(int left, int top, int z)
+{
+	guint x = (left >> z) / TILE_SIZE;
+	guint y = (top >> z) / TILE_SIZE;
+
+	return GUINT_TO_POINTER((y << 16) | x);
+}
+
+static gpointer
+tilecache_tile_key(Tile *tile)
+{
+	return tilecache_key(tile->bounds0.left, tile->bounds0.top, tile->z);
+}
+
+/* Add @delta to the descendant count for @tile on every level above it.
+ */
 static void
-tilecache_free_level(Tilecache *tilecache, int i)
+tilecache_count_tile(Tilecache *tilecache, Tile *tile, int delta)
 {
-	for (GSList *p = tilecache->tiles[i]; p; p = p->next) {
-		Tile *tile = TILE(p->data);
+	for (int i = tile->z + 1; i < MAX_LEVELS; i++) {
+		if (!tilecache->descendants[i])
+			break;
+
+		gpointer key = tilecache_key(tile->bounds0.left, tile->bounds0.top, i);
+		int count = GPOINTER_TO_INT(
+			g_hash_table_lookup(tilecache->descendants[i], key));
 
-		VIPS_UNREF(tile);
+		count = VIPS_MAX(0, count + delta);
+		if (count)
+			g_hash_table_insert(tilecache->descendants[i],
+				key, GINT_TO_POINTER(count));
+		else
+			g_hash_table_remove(tilecache->descendants[i], key);
 	}
+}
 
-	VIPS_FREEF(g_slist_free, tilecache->tiles[i]);
-	VIPS_FREEF(g_slist_free, tilecache->visible[i]);
-	VIPS_FREEF(g_slist_free, tilecache->free[i]);
+/* The number of tiles on levels below z inside the level0 rect @bounds.
+ */
+static int
+tilecache_count_descendants(Tilecache *tilecache, VipsRect *bounds, int z)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(tilecache->descendants[z],
+		tilecache_key(bounds->left, bounds->top, z)));
+}
+
+static void
+tilecache_free_level(Tilecache *tilecache, int i)
+{
+	/* The visible set is not refs, so must go before the table.
+	 */
+	VIPS_FREEF(g_ptr_array_unref, tilecache->visible[i]);
+	VIPS_FREEF(g_hash_table_destroy, tilecache->tiles[i]);
+	VIPS_FREEF(g_hash_table_destroy, tilecache->descendants[i]);
+}
+
+/* The set of valid tiles has changed, so the visible set must be recomputed.
+ */
+static void
+tilecache_invalidate_visibility(Tilecache *tilecache)
+{
+	tilecache->generation += 1;
+}
+
+/* The destroy func for the level tables.
+ */
+static void
+tilecache_tile_free(Tile *tile)
+{
+	if (tile->tilecache)
+		tilecache_count_tile(tile->tilecache, tile, -1);
+	tile_detach(tile);
+	g_object_unref(tile);
+}
+
+/* Remove a tile from a level, dropping the cache's ref.
+ */
+static void
+tilecache_remove(Tilecache *tilecache, Tile *tile)
+{
+	int z = tile->z;
+	gpointer key = tilecache_tile_key(tile);
+
+	tilecache_invalidate_visibility(tilecache);
+
+	if (tile->visible)
+		g_ptr_array_remove(tilecache->visible[z], tile);
+
+	/* A replacement tile can have the same key.
+	 */
+	if (tilecache->tiles[z] &&
+		g_hash_table_lookup(tilecache->tiles[z], key) == tile)
+		g_hash_table_remove(tilecache->tiles[z], key);
 }
 
 static void
@@ -81,12 +185,18 @@ tilecache_dispose(GObject *object)
 	FREESID(tilecache->tilesource_loaded_sid, tilecache->tilesource);
 	FREESID(tilecache->tilesource_tiles_changed_sid, tilecache->tilesource);
 	FREESID(tilecache->tilesource_collect_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_collect_done_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_display_changed_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_level_ready_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_rows_ready_sid, tilecache->tilesource);
 	VIPS_UNREF(tilecache->tilesource);
 	VIPS_UNREF(tilecache->background_texture);
 
 	for (int i = 0; i < MAX_LEVELS; i++)
 		tilecache_free_level(tilecache, i);
 
+	tilecache_all = g_slist_remove(tilecache_all, tilecache);
+
 	G_OBJECT_CLASS(tilecache_parent_class)->dispose(object);
 }
 
@@ -154,6 +264,11 @@ tilecache_init(Tilecache *tilecache)
 
 	tilecache->background = TILECACHE_BACKGROUND_CHECKERBOARD;
 	tilecache->background_texture = tilecache_texture(tilecache->background);
+
+	tilecache->last_z = -1;
+	tilecache->last_fetch_z = -1;
+
+	tilecache_all = g_slist_prepend(tilecache_all, tilecache);
 }
 
 static void
@@ -200,8 +315,33 @@ tilecache_rebuild_pyramid(Tilecache *tilecache)
 	for (int i = n_levels; i < MAX_LEVELS; i++)
 		tilecache_free_level(tilecache, i);
 
+	for (int i = 0; i < n_levels; i++)
+		if (!tilecache->tiles[i]) {
+			tilecache->tiles[i] = g_hash_table_new_full(
+				g_direct_hash, g_direct_equal,
+				NULL, (GDestroyNotify) tilecache_tile_free);
+			tilecache->visible[i] = g_ptr_array_new();
+			tilecache->descendants[i] = g_hash_table_new(
+				g_direct_hash, g_direct_equal);
+		}
+
+	/* The levels above a tile may have changed, so recount.
+	 */
+	for (int i = 0; i < n_levels; i++)
+		g_hash_table_remove_all(tilecache->descendants[i]);
+	for (int i = 0; i < n_levels; i++) {
+		GHashTableIter iter;
+		Tile *tile;
+
+		g_hash_table_iter_init(&iter, tilecache->tiles[i]);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &tile))
+			tilecache_count_tile(tilecache, tile, 1);
+	}
+
 	tilecache->n_levels = n_levels;
 
+	tilecache_invalidate_visibility(tilecache);
+
 #ifdef DEBUG
 	printf("	 %d pyr levels\n", n_levels);
 	for (int i = 0; i < n_levels; i++)
@@ -212,22 +352,33 @@ tilecache_rebuild_pyramid(Tilecache *tilecache)
 }
 
 /* All tiles need refetching, perhaps after eg. "falsecolour" etc. Mark
- * all tiles invalid and reemit.
+ * all tiles invalid and reemit. Tiles keep textures for a few previous
+ * display settings, so toggling back to them is instant.
  */
 void
 tilecache_source_tiles_changed(Tilesource *tilesource,
 	Tilecache *tilecache)
 {
+	TileDisplay display;
+
+	tilesource_get_display(tilesource, &display);
+
 #ifdef DEBUG
 	printf("tilecache_source_tiles_changed: %p\n", tilecache);
 #endif /*DEBUG*/
 
-	for (int i = 0; i < tilecache->n_levels; i++)
-		for (GSList *p = tilecache->tiles[i]; p; p = p->next) {
-			Tile *tile = TILE(p->data);
+	for (int i = 0; i < tilecache->n_levels; i++) {
+		GHashTableIter iter;
+		Tile *tile;
 
-			tile_invalidate(tile);
-		}
+		g_hash_table_iter_init(&iter, tilecache->tiles[i]);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &tile))
+			tile_set_display(tile, &display);
+	}
+
+	tilecache->display = display;
+
+	tilecache_invalidate_visibility(tilecache);
 
 	tilecache_tiles_changed(tilecache);
 }
@@ -248,15 +399,19 @@ tilecache_source_changed(Tilesource *tilesource, Tilecache *tilecache)
 	tilecache_source_tiles_changed(tilesource, tilecache);
 
 	/* Remove all invisible tiles. They could show up later and cause flicker.
+	 * Textures saved for other display settings are out of date too.
 	 */
-	for (int i = 0; i < tilecache->n_levels; i++)
-		while (tilecache->free[i]) {
-			g_autoptr(Tile) tile = TILE(tilecache->free[i]->data);
-
-			tilecache->tiles[i] = g_slist_remove(tilecache->tiles[i], tile);
-			tilecache->visible[i] = g_slist_remove(tilecache->visible[i], tile);
-			tilecache->free[i] = g_slist_remove(tilecache->free[i], tile);
-		}
+	for (int i = 0; i < tilecache->n_levels; i++) {
+		GHashTableIter iter;
+		Tile *tile;
+
+		g_hash_table_iter_init(&iter, tilecache->tiles[i]);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &tile))
+			if (!tile->visible)
+				g_hash_table_iter_remove(&iter);
+			else
+				tile_clear_generations(tile);
+	}
 
 	/* All views must update.
 	 */
@@ -275,49 +430,113 @@ tilecache_source_loaded(Tilesource *tilesource, Tilecache *tilecache)
 
 	/* Repaint to trigger a request (if necessary).
 	 */
+	tilecache_invalidate_visibility(tilecache);
 	tilecache_changed(tilecache);
 }
 
-static Tile *
-tilecache_find(Tilecache *tilecache, VipsRect *tile_rect, int z)
+/* A pipeline for a new level is ready. Tiles for that level were skipped
+ * while it was being built, so repaint to request them.
+ */
+static void
+tilecache_source_level_ready(Tilesource *tilesource, Tilecache *tilecache)
 {
-	for (GSList *p = tilecache->tiles[z]; p; p = p->next) {
-		Tile *tile = TILE(p->data);
+#ifdef DEBUG
+	printf("tilecache_source_level_ready:\n");
+#endif /*DEBUG*/
 
-		if (vips_rect_overlapsrect(&tile->bounds0, tile_rect))
-			return tile;
-	}
+	tilecache_invalidate_visibility(tilecache);
+	tilecache_changed(tilecache);
+}
 
-	return NULL;
+/* Rows of an image which is still loading have arrived. Tiles for those rows
+ * were skipped, so repaint to request them.
+ */
+static void
+tilecache_source_rows_ready(Tilesource *tilesource, VipsRect *area,
+	Tilecache *tilecache)
+{
+#ifdef DEBUG
+	printf("tilecache_source_rows_ready: top = %d, height = %d\n",
+		area->top, area->height);
+#endif /*DEBUG*/
+
+	tilecache_invalidate_visibility(tilecache);
+	tilecache_area_changed(tilecache, area, 0);
+}
+
+/* The draw-time display transform has changed, tiles have not.
+ */
+static void
+tilecache_source_display_changed(Tilesource *tilesource,
+	Tilecache *tilecache)
+{
+#ifdef DEBUG
+	printf("tilecache_source_display_changed:\n");
+#endif /*DEBUG*/
+
+	tilecache_changed(tilecache);
+}
+
+/* TRUE if a tile has current or previous pixels we can draw.
+ */
+static gboolean
+tilecache_drawable(Tile *tile)
+{
+	return tile &&
+		(tile->valid ||
+			tile->texture);
+}
+
+/* Find the tile on level z whose top-left corner is in tile_rect.
+ */
+static Tile *
+tilecache_find(Tilecache *tilecache, VipsRect *tile_rect, int z)
+{
+	return g_hash_table_lookup(tilecache->tiles[z],
+		tilecache_key(tile_rect->left, tile_rect->top, z));
 }
 
 /* Request a single tile. If we have this tile already, refresh if there are new
  * pixels available.
+ *
+ * If exclude is set, this is a prefetch and we skip tiles in exclude.
  */
 static void
-tilecache_request(Tilecache *tilecache, VipsRect *tile_rect, int z)
+tilecache_request(Tilecache *tilecache, VipsRect *tile_rect, int z,
+	VipsRect *exclude)
 {
+	gboolean prefetch = exclude != NULL;
+
+	if (prefetch &&
+		vips_rect_includesrect(exclude, tile_rect))
+		return;
+
 	/* Look for an existing tile, or make a new one.
-	 *
-	 * FIXME ... this could be a hash. Could other lookups be hashes as
-	 * well, if we rescale x/y for changes in z?
 	 */
 	Tile *tile;
 	if (!(tile = tilecache_find(tilecache, tile_rect, z))) {
 		tile = tile_new(tile_rect->left, tile_rect->top, z);
+		tile->tilecache = tilecache;
+		tile->display = tilecache->display;
 
-		tilecache->tiles[z] = g_slist_prepend(tilecache->tiles[z], tile);
+		g_hash_table_insert(tilecache->tiles[z],
+			tilecache_tile_key(tile), tile);
+		tilecache_count_tile(tilecache, tile, 1);
 	}
 
 	if (!tile->valid) {
 #ifdef DEBUG_VERBOSE
 		printf("tilecache_request: fetching left = %d, top = %d, "
-			   "width = %d, height = %d, z = %d\n",
+			   "width = %d, height = %d, z = %d, prefetch = %d\n",
 			tile_rect->left, tile_rect->top,
 			tile_rect->width, tile_rect->height,
-			z);
+			z, prefetch);
 #endif /*DEBUG_VERBOSE*/
 
+		if (prefetch &&
+			!tile->shown)
+			tile->prefetch = TRUE;
+
 		tilesource_request_tile(tilecache->tilesource, tile);
 	}
 }
@@ -329,32 +548,45 @@ tilecache_tiles_for_rect(Tilecache *tilecache, VipsRect *rect, int z,
 	VipsRect *touches)
 {
 	int size0 = TILE_SIZE << z;
-	int left = VIPS_ROUND_DOWN(rect->left, size0);
-	int top = VIPS_ROUND_DOWN(rect->top, size0);
-	int right = VIPS_ROUND_UP(VIPS_RECT_RIGHT(rect), size0);
-	int bottom = VIPS_ROUND_UP(VIPS_RECT_BOTTOM(rect), size0);
+
+	/* We can have rects outside the image, but there are never any tiles
+	 * there, and the tile index can't represent negative positions.
+	 */
+	VipsRect image = { 0, 0,
+		tilecache->level_width[0], tilecache->level_height[0] };
+	VipsRect clipped;
+	vips_rect_intersectrect(rect, &image, &clipped);
+
+	int left = VIPS_ROUND_DOWN(clipped.left, size0);
+	int top = VIPS_ROUND_DOWN(clipped.top, size0);
+	int right = VIPS_ROUND_UP(VIPS_RECT_RIGHT(&clipped), size0);
+	int bottom = VIPS_ROUND_UP(VIPS_RECT_BOTTOM(&clipped), size0);
 
 	touches->left = left;
 	touches->top = top;
 	touches->width = right - left;
 	touches->height = bottom - top;
 
-	/* We can have rects outside the image. Make sure they stay empty.
+	/* Make sure empty rects stay empty.
 	 */
-	if (vips_rect_isempty(rect)) {
+	if (vips_rect_isempty(&clipped)) {
 		touches->width = 0;
 		touches->height = 0;
 	}
 }
 
-/* Request tiles from an area. If they are not in cache, they will be computed
- * in the bg and delivered via _collect().
+/* Request tiles from an area of tiles on level z, perhaps from
+ * tilecache_tiles_for_rect(). If they are not in cache, they will be
+ * computed in the bg and delivered via _collect().
+ *
+ * If exclude is set, this is a prefetch and we skip tiles in exclude.
  *
  * We must be careful not to change tilesource if we have all these tiles
  * already (very common for thumbnails, for example).
  */
 static void
-tilecache_request_area(Tilecache *tilecache, VipsRect *rect, int z)
+tilecache_request_area(Tilecache *tilecache, VipsRect *touches, int z,
+	VipsRect *exclude)
 {
 	int size0 = TILE_SIZE << z;
 
@@ -363,29 +595,23 @@ tilecache_request_area(Tilecache *tilecache, VipsRect *rect, int z)
 		!tilecache->tilesource->rgb)
 		return;
 
-	/* All the tiles rect touches in this level.
-	 */
-	VipsRect touches;
-	tilecache_tiles_for_rect(tilecache, rect, z, &touches);
-	int left = touches.left;
-	int top = touches.top;
-	int right = VIPS_RECT_RIGHT(&touches);
-	int bottom = VIPS_RECT_BOTTOM(&touches);
+	int left = touches->left;
+	int top = touches->top;
+	int right = VIPS_RECT_RIGHT(touches);
+	int bottom = VIPS_RECT_BOTTOM(touches);
 
-	/* Build the set of rects to generate here. We need to issue these in
-	 * reverse order to get the screen to update from the centre out.
+	/* Walk the four edges, then step in, until the centre is empty.
+	 *
+	 * The bg renderer computes the most recent request first, so issuing
+	 * the outer ring first makes the screen update from the centre out.
 	 */
-	g_autoslist(VipsRect) rects = NULL;
+	VipsRect tile_rect;
+	tile_rect.width = size0;
+	tile_rect.height = size0;
 
-	/* Do the four edges, then step in. Loop until the centre is empty.
-	 */
 	for (;;) {
-		VipsRect tile_rect;
 		int x, y;
 
-		tile_rect.width = size0;
-		tile_rect.height = size0;
-
 		if (right - left <= 0 ||
 			bottom - top <= 0)
 			break;
@@ -395,7 +621,7 @@ tilecache_request_area(Tilecache *tilecache, VipsRect *rect, int z)
 		for (x = left; x < right; x += size0) {
 			tile_rect.left = x;
 			tile_rect.top = top;
-			rects = g_slist_prepend(rects, vips_rect_dup(&tile_rect));
+			tilecache_request(tilecache, &tile_rect, z, exclude);
 		}
 
 		top += size0;
@@ -408,7 +634,7 @@ tilecache_request_area(Tilecache *tilecache, VipsRect *rect, int z)
 		for (x = left; x < right; x += size0) {
 			tile_rect.left = x;
 			tile_rect.top = bottom - size0;
-			rects = g_slist_prepend(rects, vips_rect_dup(&tile_rect));
+			tilecache_request(tilecache, &tile_rect, z, exclude);
 		}
 
 		bottom -= size0;
@@ -421,7 +647,7 @@ tilecache_request_area(Tilecache *tilecache, VipsRect *rect, int z)
 		for (y = top; y < bottom; y += size0) {
 			tile_rect.left = left;
 			tile_rect.top = y;
-			rects = g_slist_prepend(rects, vips_rect_dup(&tile_rect));
+			tilecache_request(tilecache, &tile_rect, z, exclude);
 		}
 
 		left += size0;
@@ -434,21 +660,167 @@ tilecache_request_area(Tilecache *tilecache, VipsRect *rect, int z)
 		for (y = top; y < bottom; y += size0) {
 			tile_rect.left = right - size0;
 			tile_rect.top = y;
-			rects = g_slist_prepend(rects, vips_rect_dup(&tile_rect));
+			tilecache_request(tilecache, &tile_rect, z, exclude);
 		}
 
 		right -= size0;
-		if (right - left <= 0 ||
-			bottom - top <= 0)
-			break;
 	}
+}
 
-	rects = g_slist_reverse(rects);
-	for (GSList *p = rects; p; p = p->next) {
-		VipsRect *tile = (VipsRect *) p->data;
+/* Drop prefetched tiles on level z which have not arrived yet. We can't
+ * cancel the bg render, but we won't collect them.
+ */
+static void
+tilecache_drop_prefetch(Tilecache *tilecache, int z)
+{
+	GHashTableIter iter;
+	Tile *tile;
 
-		tilecache_request(tilecache, tile, z);
+	if (z < 0 ||
+		z >= tilecache->n_levels)
+		return;
+
+	g_hash_table_iter_init(&iter, tilecache->tiles[z]);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &tile))
+		if (tile->prefetch &&
+			!tile->visible &&
+			!tilecache_drawable(tile))
+			g_hash_table_iter_remove(&iter);
+
+	tilecache_invalidate_visibility(tilecache);
+}
+
+/* Track the motion of the viewport from frame to frame.
+ */
+static void
+tilecache_update_motion(Tilecache *tilecache,
+	VipsRect *viewport, int z, double scale)
+{
+	VipsRect *last = &tilecache->last_viewport;
+
+	/* Smooth the velocity, but only while panning at a fixed zoom.
+	 */
+	if (z == tilecache->last_z &&
+		abs(viewport->width - last->width) <= 1 &&
+		abs(viewport->height - last->height) <= 1) {
+		tilecache->velocity_x =
+			(tilecache->velocity_x + viewport->left - last->left) / 2;
+		tilecache->velocity_y =
+			(tilecache->velocity_y + viewport->top - last->top) / 2;
+	}
+	else {
+		tilecache->velocity_x = 0;
+		tilecache->velocity_y = 0;
+	}
+	*last = *viewport;
+
+	/* Moving more than a screen pixel a frame sets the direction. When we
+	 * stop, we keep the last direction.
+	 */
+	int direction_x = tilecache->direction_x;
+	if (tilecache->velocity_x * scale > 1)
+		direction_x = 1;
+	else if (tilecache->velocity_x * scale < -1)
+		direction_x = -1;
+
+	int direction_y = tilecache->direction_y;
+	if (tilecache->velocity_y * scale > 1)
+		direction_y = 1;
+	else if (tilecache->velocity_y * scale < -1)
+		direction_y = -1;
+
+	/* Reversing makes pending prefetches useless. They were requested at
+	 * the fetch level, which can differ from the display level during a
+	 * zoom.
+	 */
+	if (direction_x * tilecache->direction_x < 0 ||
+		direction_y * tilecache->direction_y < 0)
+		tilecache_drop_prefetch(tilecache, tilecache->last_fetch_z);
+
+	tilecache->direction_x = direction_x;
+	tilecache->direction_y = direction_y;
+}
+
+/* The area of tiles we prefetch: margin tiles all round, or twice that
+ * ahead and none behind on axes where we are moving.
+ */
+static void
+tilecache_prefetch_rect(Tilecache *tilecache, VipsRect *viewport, int z,
+	VipsRect *prefetch)
+{
+	int margin = tilecache_prefetch_margin * (TILE_SIZE << z);
+
+	int before_x = margin;
+	int after_x = margin;
+	if (tilecache->direction_x) {
+		before_x = tilecache->direction_x < 0 ? 2 * margin : 0;
+		after_x = tilecache->direction_x > 0 ? 2 * margin : 0;
 	}
+
+	int before_y = margin;
+	int after_y = margin;
+	if (tilecache->direction_y) {
+		before_y = tilecache->direction_y < 0 ? 2 * margin : 0;
+		after_y = tilecache->direction_y > 0 ? 2 * margin : 0;
+	}
+
+	VipsRect area = {
+		viewport->left - before_x,
+		viewport->top - before_y,
+		viewport->width + before_x + after_x,
+		viewport->height + before_y + after_y
+	};
+	tilecache_tiles_for_rect(tilecache, &area, z, prefetch);
+}
+
+/* Pick a pyramid layer for a scale. For enlarging, we leave the z at 0
+ * (the highest res layer).
+ */
+static int
+tilecache_level_for_scale(Tilecache *tilecache, double scale)
+{
+	if (scale > 1.0 ||
+		scale == 0)
+		return 0;
+	else
+		return VIPS_CLIP(0, log(1.0 / scale) / log(2.0),
+			tilecache->n_levels - 1);
+}
+
+/* If we are animating a zoom to another level, get the level and tiles we
+ * will need when the animation stops.
+ */
+static gboolean
+tilecache_zoom_target(Tilecache *tilecache,
+	VipsRect *viewport, double scale, int *z, VipsRect *touches)
+{
+	if (tilecache->target_scale <= 0)
+		return FALSE;
+
+	int target_z =
+		tilecache_level_for_scale(tilecache, tilecache->target_scale);
+	if (target_z == tilecache_level_for_scale(tilecache, scale))
+		return FALSE;
+
+	/* The target point stays fixed on the screen, so the viewport scales
+	 * about it.
+	 */
+	double factor = scale / tilecache->target_scale;
+	double tx = tilecache->target_x;
+	double ty = tilecache->target_y;
+	double left = tx + (viewport->left - tx) * factor;
+	double top = ty + (viewport->top - ty) * factor;
+
+	VipsRect area;
+	area.left = floor(left);
+	area.top = floor(top);
+	area.width = VIPS_MAX(1, ceil(viewport->width * factor));
+	area.height = VIPS_MAX(1, ceil(viewport->height * factor));
+
+	*z = target_z;
+	tilecache_tiles_for_rect(tilecache, &area, target_z, touches);
+
+	return TRUE;
 }
 
 /* A new tile is available from the bg render and must be collected.
@@ -466,11 +838,33 @@ tilecache_source_collect(Tilesource *tilesource,
 
 	Tile *tile = tilecache_find(tilecache, dirty, z);
 	if (tile &&
-		!tile->valid) {
+		!tile->valid)
 		tilesource_collect_tile(tilecache->tilesource, tile);
 
-		// things displaying us will need to redraw
-		tilecache_area_changed(tilecache, dirty, z);
+	// textures are packed in the background, so the tile will often only
+	// become valid on a later collect
+	if (tile &&
+		tile->valid) {
+		tilecache_invalidate_visibility(tilecache);
+
+		// things displaying us will need to redraw at the end of the batch
+		vips_rect_unionrect(&tilecache->dirty, dirty, &tilecache->dirty);
+		tilecache->dirty_z = z;
+	}
+}
+
+/* The end of a batch of collects.
+ */
+static void
+tilecache_source_collect_done(Tilesource *tilesource, Tilecache *tilecache)
+{
+	if (!vips_rect_isempty(&tilecache->dirty)) {
+		VipsRect dirty = tilecache->dirty;
+
+		tilecache->dirty.width = 0;
+		tilecache->dirty.height = 0;
+
+		tilecache_area_changed(tilecache, &dirty, tilecache->dirty_z);
 	}
 }
 
@@ -481,6 +875,10 @@ tilecache_set_tilesource(Tilecache *tilecache, Tilesource *tilesource)
 	FREESID(tilecache->tilesource_loaded_sid, tilecache->tilesource);
 	FREESID(tilecache->tilesource_tiles_changed_sid, tilecache->tilesource);
 	FREESID(tilecache->tilesource_collect_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_collect_done_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_display_changed_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_level_ready_sid, tilecache->tilesource);
+	FREESID(tilecache->tilesource_rows_ready_sid, tilecache->tilesource);
 	VIPS_UNREF(tilecache->tilesource);
 
 	tilecache->tilesource = tilesource;
@@ -501,6 +899,18 @@ tilecache_set_tilesource(Tilecache *tilecache, Tilesource *tilesource)
 		tilecache->tilesource_collect_sid =
 			g_signal_connect(tilesource, "collect",
 				G_CALLBACK(tilecache_source_collect), tilecache);
+		tilecache->tilesource_collect_done_sid =
+			g_signal_connect(tilesource, "collect-done",
+				G_CALLBACK(tilecache_source_collect_done), tilecache);
+		tilecache->tilesource_display_changed_sid =
+			g_signal_connect(tilesource, "display-changed",
+				G_CALLBACK(tilecache_source_display_changed), tilecache);
+		tilecache->tilesource_level_ready_sid =
+			g_signal_connect(tilesource, "level-ready",
+				G_CALLBACK(tilecache_source_level_ready), tilecache);
+		tilecache->tilesource_rows_ready_sid =
+			g_signal_connect(tilesource, "rows-ready",
+				G_CALLBACK(tilecache_source_rows_ready), tilecache);
 
 		/* Everything has potentially changed, including the image size.
 		 */
@@ -555,6 +965,14 @@ tilecache_get_property(GObject *object,
 		g_value_set_object(value, tilecache->tilesource);
 		break;
 
+	case PROP_PREFETCH_HITS:
+		g_value_set_int(value, tilecache->prefetch_hits);
+		break;
+
+	case PROP_PREFETCH_MISSES:
+		g_value_set_int(value, tilecache->prefetch_misses);
+		break;
+
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -585,6 +1003,20 @@ tilecache_class_init(TilecacheClass *class)
 			TILESOURCE_TYPE,
 			G_PARAM_READWRITE));
 
+	g_object_class_install_property(gobject_class, PROP_PREFETCH_HITS,
+		g_param_spec_int("prefetch-hits",
+			_("Prefetch hits"),
+			_("Prefetched tiles which were ready when they came into view"),
+			0, G_MAXINT, 0,
+			G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_PREFETCH_MISSES,
+		g_param_spec_int("prefetch-misses",
+			_("Prefetch misses"),
+			_("Tiles which came into view before their pixels arrived"),
+			0, G_MAXINT, 0,
+			G_PARAM_READABLE));
+
 	tilecache_signals[SIG_CHANGED] = g_signal_new("changed",
 		G_TYPE_FROM_CLASS(class),
 		G_SIGNAL_RUN_LAST,
@@ -612,65 +1044,244 @@ tilecache_class_init(TilecacheClass *class)
 		G_TYPE_INT);
 }
 
-/* Find the first visible tile in a hole.
- */
 static void
-tilecache_fill_hole(Tilecache *tilecache, VipsRect *bounds, int z)
+tilecache_add_visible(Tilecache *tilecache, Tile *tile)
 {
-	for (int i = z; i < tilecache->n_levels; i++) {
-		for (GSList *p = tilecache->tiles[i]; p; p = p->next) {
-			Tile *tile = TILE(p->data);
-			GSList **visible = &tilecache->visible[i];
-
-			/* Ignore tiles with no current or previous pixels.
-			 */
-			if (!tile->valid &&
-				!tile->texture)
-				continue;
+	tile_touch(tile);
+	tile->visible = TRUE;
+	g_ptr_array_add(tilecache->visible[tile->z], tile);
+}
 
-			/* Ignore tiles we're already drawing.
+/* Add the valid tiles from the levels below z which sit inside bounds, a
+ * level0 rect covering one tile on level z, using the lowest res tile we
+ * have for each part. We only search parts of the pyramid with tiles in, so
+ * the cost is the number of tiles we find times the depth. Return TRUE if
+ * we cover bounds completely.
+ */
+static gboolean
+tilecache_fill_descendants(Tilecache *tilecache, VipsRect *bounds, int z)
+{
+	int size0 = TILE_SIZE << (z - 1);
+	gboolean covered = TRUE;
+
+	for (int y = 0; y < 2; y++)
+		for (int x = 0; x < 2; x++) {
+			VipsRect child = {
+				bounds->left + x * size0,
+				bounds->top + y * size0,
+				size0,
+				size0
+			};
+
+			/* No tiles off the edge of the image.
 			 */
-			if (g_slist_index(*visible, tile) >= 0)
+			if (child.left >= tilecache->level_width[0] ||
+				child.top >= tilecache->level_height[0])
 				continue;
 
-			if (vips_rect_overlapsrect(&tile->bounds0, bounds)) {
-				tile_touch(tile);
-				*visible = g_slist_prepend(*visible, tile);
-				return;
-			}
+			Tile *tile = tilecache_find(tilecache, &child, z - 1);
+			if (tile &&
+				tile->valid)
+				tilecache_add_visible(tilecache, tile);
+			else if (z - 1 == 0 ||
+				!tilecache_count_descendants(tilecache, &child, z - 1) ||
+				!tilecache_fill_descendants(tilecache, &child, z - 1))
+				covered = FALSE;
 		}
+
+	return covered;
+}
+
+/* Find the first tile on a level above z covering bounds which is valid, or
+ * if valid is FALSE, which has any pixels.
+ */
+static Tile *
+tilecache_find_ancestor(Tilecache *tilecache, VipsRect *bounds, int z,
+	gboolean valid)
+{
+	for (int i = z + 1; i < tilecache->n_levels; i++) {
+		Tile *tile = tilecache_find(tilecache, bounds, i);
+
+		if (tile &&
+			(valid ? tile->valid : tilecache_drawable(tile)))
+			return tile;
 	}
+
+	return NULL;
 }
 
-static int
-tilecache_sort_lru(const void *a, const void *b)
+/* Fill a hole on level z, a level0 rect covering one tile.
+ *
+ * If we have no valid tile there, draw any valid higher res tiles we have in
+ * cache (eg. after zooming out), backed by the best valid lower res tile.
+ * Tiles on lower res levels are larger, so there's only ever one tile on
+ * each level which can cover bounds. Textures from before a change to the
+ * display settings are only used if there's nothing valid.
+ */
+static void
+tilecache_fill_hole(Tilecache *tilecache, VipsRect *bounds, int z)
 {
-	Tile *t1 = TILE(a);
-	Tile *t2 = TILE(b);
+	Tile *tile = tilecache_find(tilecache, bounds, z);
+
+	/* The first time a tile comes into view, count prefetch hits and
+	 * misses.
+	 */
+	if (tile &&
+		!tile->shown) {
+		tile->shown = TRUE;
 
-	return t1->time - t2->time;
+		if (!tilecache_drawable(tile))
+			tilecache->prefetch_misses += 1;
+		else if (tile->prefetch)
+			tilecache->prefetch_hits += 1;
+	}
+
+	if (tile &&
+		tile->valid) {
+		tilecache_add_visible(tilecache, tile);
+		return;
+	}
+
+	if (z > 0 &&
+		tilecache_count_descendants(tilecache, bounds, z) &&
+		tilecache_fill_descendants(tilecache, bounds, z))
+		return;
+
+	Tile *backing;
+	if (!(backing = tilecache_find_ancestor(tilecache, bounds, z, TRUE))) {
+		if (tilecache_drawable(tile))
+			backing = tile;
+		else
+			backing = tilecache_find_ancestor(tilecache, bounds, z, FALSE);
+	}
+
+	/* Already drawing this tile for another hole? Then this hole is
+	 * filled too.
+	 */
+	if (backing &&
+		!backing->visible)
+		tilecache_add_visible(tilecache, backing);
+}
+
+/* TRUE for caches which are not on the screen, eg. the hidden images in a
+ * window's stack of recent images.
+ */
+static gboolean
+tilecache_hidden(Tilecache *tilecache)
+{
+	return !tilecache->tilesource ||
+		!tilecache->tilesource->visible;
+}
+
+/* TRUE if we can free this tile.
+ */
+static gboolean
+tilecache_can_free(Tile *tile, gboolean hidden_only)
+{
+	Tilecache *tilecache = tile->tilecache;
+
+	/* Tiles a cache has dropped will go when their pack is done.
+	 */
+	if (!tilecache)
+		return FALSE;
+
+	/* Tiles with no pixels free no memory, but we don't want to walk past
+	 * them on every trim. Free them once they've been out of view for a
+	 * while. A render still on the way for one is just ignored.
+	 */
+	if (!tile_get_size(tile))
+		return !tile->visible &&
+			!tile->pack_serial &&
+			(tilecache_hidden(tilecache) ||
+				tile_get_time() - tile->time > TILECACHE_EMPTY_AGE);
+
+	/* Nothing in a hidden cache is on screen, so every tile is a candidate.
+	 */
+	if (tilecache_hidden(tilecache))
+		return TRUE;
+
+	/* Never free visible tiles, or tiles in the lowest-res few levels of
+	 * caches on screen. They are useful for filling in holes and take
+	 * little memory.
+	 */
+	return !hidden_only &&
+		!tile->visible &&
+		tile->z < tilecache->n_levels - 3;
 }
 
+/* Walk the LRU from the oldest tile, freeing tiles until we are within the
+ * memory budget.
+ */
 static void
-tilecache_free_oldest(Tilecache *tilecache, int z)
+tilecache_trim_lru(gboolean hidden_only)
 {
-	int n_free = g_slist_length(tilecache->free[z]);
-	int n_to_free = VIPS_MAX(0, n_free - MAX_TILES);
+	Tile *next;
 
-	if (n_to_free > 0) {
-		tilecache->free[z] = g_slist_sort(tilecache->free[z],
-			tilecache_sort_lru);
+	for (Tile *tile = tile_get_lru();
+		 tile && tile_get_memory() > tilecache_memory_limit;
+		 tile = next) {
+		next = tile->lru_next;
 
-		for (int i = 0; i < n_to_free; i++) {
-			g_autoptr(Tile) tile = TILE(tilecache->free[z]->data);
+		if (tilecache_can_free(tile, hidden_only))
+			tilecache_remove(tile->tilecache, tile);
+	}
+}
 
-			g_assert(g_slist_find(tilecache->tiles[z], tile));
+/* Free tiles until we are within the memory budget. This is global: we
+ * look at every tilecache in the process. Tiles from hidden caches go
+ * first, then least recently used.
+ */
+static void
+tilecache_trim(void)
+{
+	if (tile_get_memory() <= tilecache_memory_limit)
+		return;
 
-			tilecache->tiles[z] = g_slist_remove(tilecache->tiles[z], tile);
-			tilecache->visible[z] = g_slist_remove(tilecache->visible[z], tile);
-			tilecache->free[z] = g_slist_remove(tilecache->free[z], tile);
+	for (GSList *p = tilecache_all; p; p = p->next)
+		if (tilecache_hidden((Tilecache *) p->data)) {
+			tilecache_trim_lru(TRUE);
+			break;
 		}
-	}
+
+	tilecache_trim_lru(FALSE);
+
+#ifdef DEBUG
+	printf("tilecache_trim: %zd bytes of tiles, limit %zd\n",
+		tile_get_memory(), tilecache_memory_limit);
+#endif /*DEBUG*/
+}
+
+/* Set the memory budget for tiles, in bytes, summed over all tilecaches. The
+ * pool of spare texture buffers is sized from this too.
+ */
+void
+tilecache_set_memory_limit(gsize limit)
+{
+	tilecache_memory_limit = limit;
+	tile_set_pool_limit(limit / TILE_POOL_FRACTION);
+	tilesource_set_pyramid_memory(limit / TILESOURCE_PYRAMID_FRACTION);
+	tilecache_trim();
+}
+
+/* Set the number of tiles to prefetch around the viewport for all
+ * tilecaches.
+ */
+void
+tilecache_set_prefetch_margin(int margin)
+{
+	tilecache_prefetch_margin = VIPS_MAX(0, margin);
+}
+
+/* Set the scale a zoom animation will end at, and the level0 image point
+ * which stays fixed. Set scale to 0 when the animation stops.
+ */
+void
+tilecache_set_zoom_target(Tilecache *tilecache,
+	double scale, double x, double y)
+{
+	tilecache->target_scale = scale;
+	tilecache->target_x = x;
+	tilecache->target_y = y;
 }
 
 #ifdef DEBUG_VERBOSE
@@ -679,19 +1290,19 @@ tilecache_print(Tilecache *tilecache)
 {
 	for (int i = 0; i < tilecache->n_levels; i++)
 		if (tilecache->tiles[i])
-			printf("  level %d, %d tiles, %d visible, %d free\n",
+			printf("  level %d, %d tiles, %d visible\n",
 				i,
-				g_slist_length(tilecache->tiles[i]),
-				g_slist_length(tilecache->visible[i]),
-				g_slist_length(tilecache->free[i]));
+				g_hash_table_size(tilecache->tiles[i]),
+				tilecache->visible[i]->len);
 
 	for (int i = 0; i < tilecache->n_levels; i++)
 		if (tilecache->tiles[i]) {
-			printf("  level %d tiles:\n", i);
-			for (GSList *p = tilecache->tiles[i]; p; p = p->next) {
-				Tile *tile = TILE(p->data);
-				int visible = g_slist_index(tilecache->visible[i], tile) >= 0;
+			GHashTableIter iter;
+			Tile *tile;
 
+			printf("  level %d tiles:\n", i);
+			g_hash_table_iter_init(&iter, tilecache->tiles[i]);
+			while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &tile)) {
 				printf("    @ %d x %d, %d x %d, "
 					   "valid = %d, visible = %d, "
 					   "texture = %p\n",
@@ -700,7 +1311,7 @@ tilecache_print(Tilecache *tilecache)
 					tile->bounds0.width,
 					tile->bounds0.height,
 					tile->valid,
-					visible,
+					tile->visible,
 					tile->texture);
 			}
 		}
@@ -712,17 +1323,19 @@ tilecache_compute_visibility(Tilecache *tilecache,
 	VipsRect *viewport, int z)
 {
 	int size0 = TILE_SIZE << z;
-	int start_time = tile_get_time();
 
 #ifdef DEBUG_VERBOSE
 	printf("tilecache_compute_visibility: z = %d\n", z);
 #endif /*DEBUG_VERBOSE*/
 
-	/* We're rebuilding these.
+	/* We're rebuilding these. Keep the arrays so we don't allocate.
 	 */
 	for (int i = 0; i < tilecache->n_levels; i++) {
-		VIPS_FREEF(g_slist_free, tilecache->visible[i]);
-		VIPS_FREEF(g_slist_free, tilecache->free[i]);
+		GPtrArray *visible = tilecache->visible[i];
+
+		for (guint j = 0; j < visible->len; j++)
+			TILE(g_ptr_array_index(visible, j))->visible = FALSE;
+		g_ptr_array_set_size(visible, 0);
 	}
 
 	/* The rect of tiles touched by the viewport.
@@ -751,25 +1364,9 @@ tilecache_compute_visibility(Tilecache *tilecache,
 			tilecache_fill_hole(tilecache, &bounds, z);
 		}
 
-	/* So any tiles we've not touched must be invisible and therefore
-	 * candidates for freeing.
+	/* Free unused tiles from any cache if we're over the memory budget.
 	 */
-	for (int i = 0; i < tilecache->n_levels; i++) {
-		for (GSList *p = tilecache->tiles[i]; p; p = p->next) {
-			Tile *tile = TILE(p->data);
-
-			if (tile->time < start_time)
-				tilecache->free[i] = g_slist_prepend(tilecache->free[i], tile);
-		}
-	}
-
-	/* Free the oldest few unused tiles in each level.
-	 *
-	 * Never free tiles in the lowest-res few levels. They are useful for
-	 * filling in holes and take little memory.
-	 */
-	for (int i = 0; i < tilecache->n_levels - 3; i++)
-		tilecache_free_oldest(tilecache, i);
+	tilecache_trim();
 
 #ifdef DEBUG_VERBOSE
 	tilecache_print(tilecache);
@@ -784,6 +1381,31 @@ tilecache_new(void)
 	return tilecache;
 }
 
+#ifdef HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER
+/* Push a transfer node for the log display curve. The table has an entry
+ * for each 8-bit value, so it's exact for 8-bit tiles.
+ */
+static void
+tilecache_push_log(GtkSnapshot *snapshot)
+{
+	static GskComponentTransfer *log_transfer = NULL;
+	static GskComponentTransfer *identity = NULL;
+
+	if (!log_transfer) {
+		float table[256];
+
+		for (int i = 0; i < 256; i++)
+			table[i] = tilesource_log_value(i) / 255.0;
+
+		log_transfer = gsk_component_transfer_new_table(256, table);
+		identity = gsk_component_transfer_new_identity();
+	}
+
+	gtk_snapshot_push_component_transfer(snapshot,
+		log_transfer, log_transfer, log_transfer, identity);
+}
+#endif /*HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER*/
+
 static void
 tilecache_draw_bounds(GtkSnapshot *snapshot,
 	Tile *tile, graphene_rect_t *bounds)
@@ -849,6 +1471,102 @@ tilecache_snap_rect(graphene_rect_t *bounds)
 }
 #endif /*!HAVE_GTK_SNAPSHOT_SET_SNAP*/
 
+/* @paint in level0 coordinates.
+ */
+static void
+tilecache_viewport(double scale, double x, double y, graphene_rect_t *paint,
+	VipsRect *viewport)
+{
+	double left = floor(x / scale);
+	double top = floor(y / scale);
+	double right = ceil((x + paint->size.width) / scale);
+	double bottom = ceil((y + paint->size.height) / scale);
+
+	viewport->left = left;
+	viewport->top = top;
+	viewport->width = VIPS_MAX(1, right - left);
+	viewport->height = VIPS_MAX(1, bottom - top);
+}
+
+/* Fetch the tiles we need to paint @paint, and find the visible set. This
+ * is the part of tilecache_snapshot() that doesn't draw, and it should
+ * make no heap allocations once the tiles are in cache.
+ */
+void
+tilecache_update(Tilecache *tilecache,
+	double scale, double x, double y, graphene_rect_t *paint)
+{
+	int z = tilecache_level_for_scale(tilecache, scale);
+
+	VipsRect viewport;
+	tilecache_viewport(scale, x, y, paint, &viewport);
+
+	tilecache_update_motion(tilecache, &viewport, z, scale);
+
+	/* The tiles we can see.
+	 */
+	VipsRect touches;
+	tilecache_tiles_for_rect(tilecache, &viewport, z, &touches);
+
+	/* The tiles we fetch, and the tiles we prefetch around them.
+	 *
+	 * If we're animating a zoom to another level, also fetch the tiles we
+	 * will need at the end, so they are ready when the zoom stops.
+	 * Tilesource keeps pipelines for several levels, so fetching for both
+	 * levels doesn't make it rebuild. We don't prefetch while zooming.
+	 */
+	int fetch_z;
+	VipsRect fetch;
+	VipsRect prefetch;
+	gboolean zooming =
+		tilecache_zoom_target(tilecache, &viewport, scale, &fetch_z, &fetch);
+	if (zooming)
+		prefetch = fetch;
+	else {
+		fetch_z = z;
+		fetch = touches;
+		tilecache_prefetch_rect(tilecache, &viewport, z, &prefetch);
+	}
+
+	/* If we've not crossed a tile boundary or changed level, and no tiles
+	 * have arrived or been freed, the visible set is unchanged and we've
+	 * already requested everything. This is very common when panning.
+	 */
+	if (z != tilecache->last_z ||
+		fetch_z != tilecache->last_fetch_z ||
+		tilecache->generation != tilecache->last_generation ||
+		!vips_rect_equalsrect(&touches, &tilecache->last_touches) ||
+		!vips_rect_equalsrect(&fetch, &tilecache->last_fetch) ||
+		!vips_rect_equalsrect(&prefetch, &tilecache->last_prefetch)) {
+		/* The bg renderer computes the most recent request first, so
+		 * prefetch before we fetch the tiles we need.
+		 */
+		tilecache_request_area(tilecache, &prefetch, fetch_z, &fetch);
+
+		/* Fetch any tiles we are missing, update any tiles we have that
+		 * have been flagged as having pixels ready for fetching.
+		 */
+		tilecache_request_area(tilecache, &fetch, fetch_z, NULL);
+
+		/* While zooming, fill in the level on screen now as well. It's
+		 * requested last, so it's computed first.
+		 */
+		if (zooming)
+			tilecache_request_area(tilecache, &touches, z, NULL);
+
+		/* Find the set of visible tiles, sorted back to front.
+		 */
+		tilecache_compute_visibility(tilecache, &viewport, z);
+
+		tilecache->last_touches = touches;
+		tilecache->last_fetch = fetch;
+		tilecache->last_prefetch = prefetch;
+		tilecache->last_z = z;
+		tilecache->last_fetch_z = fetch_z;
+		tilecache->last_generation = tilecache->generation;
+	}
+}
+
 /* Scale is how much the level0 image has been scaled, x/y is the position of
  * the top-left corner of @paint in the scaled image.
  *
@@ -893,40 +1611,7 @@ tilecache_snapshot(Tilecache *tilecache, GtkSnapshot *snapshot,
 	tilecache_print(tilecache);
 #endif /*DEBUG_VERBOSE*/
 
-	/* Pick a pyramid layer. For enlarging, we leave the z at 0
-	 * (the highest res layer).
-	 */
-	int z;
-	if (scale > 1.0 ||
-		scale == 0)
-		z = 0;
-	else
-		z = VIPS_CLIP(0, log(1.0 / scale) / log(2.0), tilecache->n_levels - 1);
-
-	/* paint_rect in level0 coordinates.
-	 */
-	double left = floor(x / scale);
-	double top = floor(y / scale);
-	double right = ceil((x + paint->size.width) / scale);
-	double bottom = ceil((y + paint->size.height) / scale);
-
-	VipsRect viewport;
-	viewport.left = left;
-	viewport.top = top;
-	viewport.width = VIPS_MAX(1, right - left);
-	viewport.height = VIPS_MAX(1, bottom - top);
-
-	/* Fetch any tiles we are missing, update any tiles we have that have
-	 * been flagged as having pixels ready for fetching.
-	 */
-	tilecache_request_area(tilecache, &viewport, z);
-
-	/* Find the set of visible tiles, sorted back to front.
-	 *
-	 * FIXME ... we could often skip this, esp. when panning, unless we
-	 * cross a tile boundary.
-	 */
-	tilecache_compute_visibility(tilecache, &viewport, z);
+	tilecache_update(tilecache, scale, x, y, paint);
 
 	/* Paint the backdrop.
 	 */
@@ -946,11 +1631,12 @@ tilecache_snapshot(Tilecache *tilecache, GtkSnapshot *snapshot,
 	gtk_snapshot_pop(snapshot);
 
 	/* Draw all visible tiles, low res (at the back) to high res (at the
-	 * front).
+	 * front). There can be visible tiles below z if we are filling holes
+	 * with higher res tiles.
 	 */
-	for (int i = tilecache->n_levels - 1; i >= z; i--)
-		for (GSList *p = tilecache->visible[i]; p; p = p->next) {
-			Tile *tile = TILE(p->data);
+	for (int i = tilecache->n_levels - 1; i >= 0; i--)
+		for (guint j = 0; j < tilecache->visible[i]->len; j++) {
+			Tile *tile = TILE(g_ptr_array_index(tilecache->visible[i], j));
 
 			/* If we are zooming in beyond 1:1, we want nearest so we don't
 			 * blur the image. For zooming out, we want trilinear to get
@@ -959,18 +1645,58 @@ tilecache_snapshot(Tilecache *tilecache, GtkSnapshot *snapshot,
 			GskScalingFilter filter = scale >= 1.0 ?
 				GSK_SCALING_FILTER_NEAREST : GSK_SCALING_FILTER_TRILINEAR;
 
+			GdkTexture *texture = tile_get_texture(tile);
 			graphene_rect_t bounds;
 
+			// edge tiles have textures smaller than the tile
 			bounds.origin.x = tile->bounds0.left * scale - x + paint->origin.x;
 			bounds.origin.y = tile->bounds0.top * scale - y + paint->origin.y;
-			bounds.size.width = tile->bounds0.width * scale;
-			bounds.size.height = tile->bounds0.height * scale;
+			bounds.size.width =
+				(gdk_texture_get_width(texture) << tile->z) * scale;
+			bounds.size.height =
+				(gdk_texture_get_height(texture) << tile->z) * scale;
 
 #ifndef HAVE_GTK_SNAPSHOT_SET_SNAP
 			tilecache_snap_rect(&bounds);
 #endif /*!HAVE_GTK_SNAPSHOT_SET_SNAP*/
+			/* Float tiles, and tiles made before a change to scale and
+			 * offset, need those applying as we draw. Log goes on first,
+			 * so it's the inner node.
+			 */
+			double draw_scale;
+			double draw_offset;
+			gboolean log;
+			gboolean transform = tilecache->tilesource &&
+				tilesource_get_draw_transform(tilecache->tilesource,
+					tile->scale, tile->offset,
+					&draw_scale, &draw_offset, &log);
+			if (transform) {
+				graphene_matrix_t matrix;
+				graphene_vec4_t offset;
+
+				graphene_matrix_init_scale(&matrix,
+					draw_scale, draw_scale, draw_scale);
+				graphene_vec4_init(&offset,
+					draw_offset, draw_offset, draw_offset, 0.0);
+				gtk_snapshot_push_color_matrix(snapshot, &matrix, &offset);
+
+#ifdef HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER
+				if (log)
+					tilecache_push_log(snapshot);
+#endif /*HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER*/
+			}
+
 			gtk_snapshot_append_scaled_texture(snapshot,
-				tile_get_texture(tile), filter, &bounds);
+				texture, filter, &bounds);
+
+			if (transform) {
+#ifdef HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER
+				if (log)
+					gtk_snapshot_pop(snapshot);
+#endif /*HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER*/
+
+				gtk_snapshot_pop(snapshot);
+			}
 
 			/* In debug mode, draw the edges and add text for the
 			 * tile pointer and age.
@@ -984,8 +1710,11 @@ tilecache_snapshot(Tilecache *tilecache, GtkSnapshot *snapshot,
 	if (debug) {
 #define BORDER ((GdkRGBA){ 1, 0, 0, 1 })
 
+		VipsRect viewport;
 		GskRoundedRect outline;
 
+		tilecache_viewport(scale, x, y, paint, &viewport);
+
 		gsk_rounded_rect_init_from_rect(&outline,
 			&GRAPHENE_RECT_INIT(
 				viewport.left * scale - x + paint->origin.x,
@@ -1001,8 +1730,16 @@ tilecache_snapshot(Tilecache *tilecache, GtkSnapshot *snapshot,
 	}
 
 #ifdef DEBUG_RENDER_TIME
-	printf("tilecache_snapshot: %g ms\n",
-		g_timer_elapsed(snapshot_timer, NULL) * 1000);
+{
+	int n_tiles = 0;
+	for (int i = 0; i < tilecache->n_levels; i++)
+		n_tiles += g_hash_table_size(tilecache->tiles[i]);
+
+	printf("tilecache_snapshot: %g ms, %d tiles, "
+		   "%d prefetch hits, %d misses\n",
+		g_timer_elapsed(snapshot_timer, NULL) * 1000, n_tiles,
+		tilecache->prefetch_hits, tilecache->prefetch_misses);
 	g_timer_destroy(snapshot_timer);
+}
 #endif /*DEBUG_RENDER_TIME*/
 }
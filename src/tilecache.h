@@ -38,6 +38,15 @@ typedef enum _TilecacheBackground {
 	TILECACHE_BACKGROUND_LAST
 } TilecacheBackground;
 
+/* Default memory budget for tile pixels, shared by all caches. Enough for
+ * several 4k displays.
+ */
+#define TILECACHE_MEMORY_DEFAULT (512 * 1024 * 1024)
+
+/* Default number of tiles to prefetch around the viewport.
+ */
+#define TILECACHE_PREFETCH_DEFAULT (1)
+
 #define TILECACHE_TYPE (tilecache_get_type())
 #define TILECACHE(obj) \
 	(G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_TILECACHE, Tilecache))
@@ -67,32 +76,86 @@ typedef struct _Tilecache {
 	int level_height[MAX_LEVELS];
 	int n_levels;
 
-	/* For each level, a list of all the RGBA tiles on that level. This is the
-	 * list that holds the tile references.
+	/* For each level, a hash table of all the RGBA tiles on that level,
+	 * indexed by tile column and row. This holds the tile references.
 	 */
-	GSList *tiles[MAX_LEVELS];
+	GHashTable *tiles[MAX_LEVELS];
 
-	/* The result of the visibility test: for each level, the list of
+	/* For each level, the number of tiles on the levels below inside each
+	 * tile position, indexed like tiles. We use this to find the tiles
+	 * inside a hole without searching empty parts of the pyramid.
+	 */
+	GHashTable *descendants[MAX_LEVELS];
+
+	/* The result of the visibility test: for each level, the array of
 	 * valid tiles which touch the viewport and which are not
-	 * obscured.
+	 * obscured. Invisible tiles are on the global LRU in tile.c.
+	 */
+	GPtrArray *visible[MAX_LEVELS];
+
+	/* Bumped whenever the set of valid tiles changes.
+	 */
+	guint generation;
+
+	/* The tile grid rect, level and generation we last computed visibility
+	 * for. If none of these have changed, the visible set is still
+	 * correct and all the tiles have been requested.
+	 */
+	VipsRect last_touches;
+	VipsRect last_fetch;
+	VipsRect last_prefetch;
+	int last_z;
+	int last_fetch_z;
+	guint last_generation;
+
+	/* If a zoom is animating, the scale it will end at and the level0
+	 * image point that stays fixed. We fetch tiles for the destination
+	 * early. A target_scale of 0 means no animation.
 	 */
-	GSList *visible[MAX_LEVELS];
+	double target_scale;
+	double target_x;
+	double target_y;
 
-	/* For each level, the valid but invisible tiles we are
-	 * keeping for now on LRU.
+	/* The viewport last frame, a smoothed velocity in level0 pixels per
+	 * frame, and the direction of recent motion on each axis (-1, 0 or
+	 * 1). We prefetch ahead of the direction of motion.
+	 */
+	VipsRect last_viewport;
+	double velocity_x;
+	double velocity_y;
+	int direction_x;
+	int direction_y;
+
+	/* Prefetched tiles which were ready when they came into view, and tiles
+	 * which came into view with no pixels.
 	 */
-	GSList *free[MAX_LEVELS];
+	int prefetch_hits;
+	int prefetch_misses;
 
 	/* Paint the backdrop with this.
 	 */
 	GdkTexture *background_texture;
 
+	/* The display settings for new tiles, see tilesource_get_display().
+	 */
+	TileDisplay display;
+
 	/* The signals we watch tilesource with.
 	 */
 	guint tilesource_changed_sid;
 	guint tilesource_loaded_sid;
 	guint tilesource_tiles_changed_sid;
 	guint tilesource_collect_sid;
+	guint tilesource_collect_done_sid;
+	guint tilesource_display_changed_sid;
+	guint tilesource_level_ready_sid;
+	guint tilesource_rows_ready_sid;
+
+	/* The area and level of the tiles collected in the current batch. We
+	 * emit a single area-changed at the end of each batch.
+	 */
+	VipsRect dirty;
+	int dirty_z;
 
 } Tilecache;
 
@@ -107,8 +170,16 @@ GType tilecache_get_type(void);
 
 Tilecache *tilecache_new();
 
+void tilecache_set_memory_limit(gsize limit);
+void tilecache_set_prefetch_margin(int margin);
+
+void tilecache_set_zoom_target(Tilecache *tilecache,
+	double scale, double x, double y);
+
 /* Render the tiles to a snapshot.
  */
+void tilecache_update(Tilecache *tilecache,
+	double scale, double x, double y, graphene_rect_t *paint);
 void tilecache_snapshot(Tilecache *tilecache, GtkSnapshot *snapshot,
 	double scale, double x, double y, graphene_rect_t *paint, gboolean debug);
 
@@ -35,10 +35,53 @@
 
 #include "vipsdisp.h"
 
+#include <glib/gstdio.h>
+
 /* Use this threadpool to do background loads of images.
  */
 static GThreadPool *tilesource_background_load_pool = NULL;
 
+/* Use this threadpool to pack computed tiles into textures.
+ */
+static GThreadPool *tilesource_pack_pool = NULL;
+
+/* New levels are built in the background with this.
+ */
+static GThreadPool *tilesource_build_pool = NULL;
+
+/* Recompute this many ms after the scale and offset stop changing.
+ */
+#define TILESOURCE_LINEAR_DELAY (300)
+
+/* Make float tiles for new tilesources.
+ */
+static gboolean tilesource_float_default = FALSE;
+
+/* The tile caches on the levels of generated pyramids share this many bytes,
+ * see tilesource_pyramid_level().
+ */
+static gsize tilesource_pyramid_memory =
+	TILECACHE_MEMORY_DEFAULT / TILESOURCE_PYRAMID_FRACTION;
+
+/* Convert large images with no pyramid and no random access to a tiled
+ * pyramidal TIFF in the user cache dir, and display from that.
+ */
+static gboolean tilesource_pyramid_cache = FALSE;
+static gint64 tilesource_pyramid_cache_pixels = 100 * 1000 * 1000;
+
+/* Trim the least recently used cached pyramids to keep under this many bytes.
+ */
+static gint64 tilesource_pyramid_cache_size = (gint64) 10000 * 1024 * 1024;
+
+/* Conversions run one at a time in this.
+ */
+static GThreadPool *tilesource_convert_pool = NULL;
+
+/* Large images without random access are decoded in this, see
+ * tilesource_decode_start().
+ */
+static GThreadPool *tilesource_decode_pool = NULL;
+
 G_DEFINE_TYPE(Tilesource, tilesource, G_TYPE_OBJECT);
 
 enum {
@@ -64,14 +107,187 @@ enum {
 	SIG_CHANGED,
 	SIG_TILES_CHANGED,
 	SIG_COLLECT,
+	SIG_COLLECT_DONE,
+	SIG_DISPLAY_CHANGED,
 	SIG_PAGE_CHANGED,
 	SIG_LOADED,
+	SIG_LEVEL_READY,
+	SIG_ROWS_READY,
 
 	SIG_LAST
 };
 
 static guint tilesource_signals[SIG_LAST] = { 0 };
 
+typedef struct _TilesourceUpdate {
+	/* Next update on the tilesource's stack of computed tiles.
+	 */
+	struct _TilesourceUpdate *next;
+
+	Tilesource *tilesource;
+	VipsImage *image;
+	VipsRect rect;
+	int z;
+
+	/* Set for a texture made by tilesource_pack_worker(), which holds refs
+	 * to the tile and tilesource. The texture is NULL if the pixels had
+	 * dropped out of the libvips cache.
+	 */
+	Tile *tile;
+	GdkTexture *texture;
+	guint serial;
+	double scale;
+	double offset;
+} TilesourceUpdate;
+
+/* A display pipeline for a z other than current_z. We keep a few, each with
+ * its own sink_screen, so tiles can be in flight at several levels at once.
+ */
+typedef struct _TilesourceLevel {
+	int z;
+	VipsImage *image;
+	VipsImage *mask;
+	VipsRegion *image_region;
+	VipsRegion *mask_region;
+	VipsImage *rgb;
+	VipsRegion *rgb_region;
+} TilesourceLevel;
+
+/* Keep pipelines for up to this many z levels, including current_z.
+ */
+#define TILESOURCE_LEVELS (4)
+
+/* The tilesource state that tilesource_image() reads. Levels are built in
+ * the background while the main thread changes page, mode and so on, so
+ * builds work from a copy made on the main thread.
+ */
+typedef struct _TilesourceView {
+	TilesourceType type;
+	TilesourceMode mode;
+	const char *loader;
+	char *filename;
+	char *cache_filename;
+	gboolean subifd_pyramid;
+	gboolean page_pyramid;
+	int page;
+	int n_pages;
+	double zoom;
+	int level_count;
+	int level_width[MAX_LEVELS];
+	int level_height[MAX_LEVELS];
+	gboolean synchronous;
+	int priority;
+
+	/* Display from base, since it's the pixels we decoded.
+	 */
+	gboolean decoded;
+
+	/* The display settings the rgb half of the pipeline bakes in.
+	 */
+	gboolean active;
+	double scale;
+	double offset;
+	gboolean falsecolour;
+	gboolean log;
+	gboolean icc;
+	gboolean float_tiles;
+
+	/* Refs, or NULL. preview is only set while we're loading.
+	 */
+	VipsImage *base;
+	VipsImage *preview;
+} TilesourceView;
+
+/* The rgb half of a pipeline, see tilesource_view_rgb().
+ */
+typedef struct _TilesourceRgb {
+	VipsImage *rgb;
+	gboolean rgb_float;
+	gboolean rgb_linear;
+	gboolean rgb_transfer;
+	double rgb_max;
+	double rgb_scale;
+	double rgb_offset;
+} TilesourceRgb;
+
+/* A pipeline for a level being built in the background. serial is the
+ * tilesource build_serial when we started. If the build fails, error is the
+ * message.
+ */
+typedef struct _TilesourceBuild {
+	Tilesource *tilesource;
+	TilesourceView view;
+	int z;
+	guint serial;
+
+	VipsImage *image;
+	VipsImage *mask;
+	TilesourceRgb rgb;
+	int image_width;
+	int image_height;
+	char *error;
+} TilesourceBuild;
+
+/* A tile waiting to be packed into a texture.
+ */
+typedef struct _TilesourcePack {
+	Tilesource *tilesource;
+	Tile *tile;
+	guint serial;
+	double scale;
+	double offset;
+
+	VipsImage *rgb;
+	VipsImage *mask;
+	VipsRect hit;
+} TilesourcePack;
+
+static void
+tilesource_free_updates(TilesourceUpdate *updates)
+{
+	while (updates) {
+		TilesourceUpdate *next = updates->next;
+
+		if (updates->tile) {
+			VIPS_UNREF(updates->texture);
+			VIPS_UNREF(updates->tile);
+			VIPS_UNREF(updates->tilesource);
+		}
+
+		/* Matches the g_new0() in tilesource_render_notify() and
+		 * tilesource_pack_worker().
+		 */
+		g_free(updates);
+		updates = next;
+	}
+}
+
+static void
+tilesource_level_free(TilesourceLevel *level)
+{
+	VIPS_UNREF(level->image_region);
+	VIPS_UNREF(level->mask_region);
+	VIPS_UNREF(level->rgb_region);
+	VIPS_UNREF(level->image);
+	VIPS_UNREF(level->mask);
+	VIPS_UNREF(level->rgb);
+	g_free(level);
+}
+
+static void
+tilesource_free_levels(Tilesource *tilesource)
+{
+	g_slist_free_full(g_steal_pointer(&tilesource->levels),
+		(GDestroyNotify) tilesource_level_free);
+}
+
+static void
+tilesource_free_pyramid(Tilesource *tilesource)
+{
+	for (int i = 0; i < MAX_LEVELS; i++)
+		VIPS_UNREF(tilesource->pyramid[i]);
+}
+
 static void
 tilesource_dispose(GObject *object)
 {
@@ -82,8 +298,13 @@ tilesource_dispose(GObject *object)
 #endif /*DEBUG_MAKE*/
 
 	VIPS_FREEF(g_source_remove, tilesource->page_flip_id);
+	VIPS_FREEF(g_source_remove, tilesource->linear_timeout);
+
+	tilesource_free_updates(
+		g_atomic_pointer_exchange(&tilesource->updates, NULL));
 
 	VIPS_FREE(tilesource->filename);
+	VIPS_FREE(tilesource->cache_filename);
 
 	VIPS_UNREF(tilesource->base);
 	VIPS_UNREF(tilesource->image);
@@ -92,6 +313,10 @@ tilesource_dispose(GObject *object)
 	VIPS_UNREF(tilesource->mask_region);
 	VIPS_UNREF(tilesource->rgb);
 	VIPS_UNREF(tilesource->rgb_region);
+	tilesource_free_levels(tilesource);
+	tilesource_free_pyramid(tilesource);
+
+	VIPS_UNREF(tilesource->preview);
 
 	VIPS_FREE(tilesource->delay);
 	VIPS_FREE(tilesource->load_message);
@@ -99,6 +324,16 @@ tilesource_dispose(GObject *object)
 	G_OBJECT_CLASS(tilesource_parent_class)->dispose(object);
 }
 
+static void
+tilesource_finalize(GObject *object)
+{
+	Tilesource *tilesource = TILESOURCE(object);
+
+	g_mutex_clear(&tilesource->pyramid_lock);
+
+	G_OBJECT_CLASS(tilesource_parent_class)->finalize(object);
+}
+
 void
 tilesource_changed(Tilesource *tilesource)
 {
@@ -117,6 +352,18 @@ tilesource_collect(Tilesource *tilesource, VipsRect *dirty, int z)
 	g_signal_emit(tilesource, tilesource_signals[SIG_COLLECT], 0, dirty, z);
 }
 
+static void
+tilesource_display_changed(Tilesource *tilesource)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_DISPLAY_CHANGED], 0);
+}
+
+static void
+tilesource_collect_done(Tilesource *tilesource)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_COLLECT_DONE], 0);
+}
+
 static void
 tilesource_page_changed(Tilesource *tilesource)
 {
@@ -129,136 +376,309 @@ tilesource_loaded(Tilesource *tilesource)
 	g_signal_emit(tilesource, tilesource_signals[SIG_LOADED], 0);
 }
 
-typedef struct _TilesourceUpdate {
-	Tilesource *tilesource;
-	VipsImage *image;
-	VipsRect rect;
-	int z;
-} TilesourceUpdate;
+static void
+tilesource_level_ready(Tilesource *tilesource)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_LEVEL_READY], 0);
+}
+
+static void
+tilesource_rows_ready(Tilesource *tilesource, VipsRect *area)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_ROWS_READY], 0, area);
+}
 
-/* Open a specified level. Take page (if relevant) from the tilesource.
+/* A ref to the preview we display while loading, or NULL.
  */
 static VipsImage *
-tilesource_open(Tilesource *tilesource, int level)
+tilesource_get_preview(Tilesource *tilesource)
+{
+	VipsImage *preview;
+
+	g_mutex_lock(&tilesource->pyramid_lock);
+	if ((preview = tilesource->preview))
+		g_object_ref(preview);
+	g_mutex_unlock(&tilesource->pyramid_lock);
+
+	return preview;
+}
+
+/* Copy the state we need to build a pipeline. Main thread only.
+ */
+static void
+tilesource_view_init(TilesourceView *view, Tilesource *tilesource)
+{
+	view->type = tilesource->type;
+	view->mode = tilesource->mode;
+	view->loader = tilesource->loader;
+	view->filename = g_strdup(tilesource->filename);
+	view->cache_filename = g_strdup(tilesource->cache_filename);
+	view->subifd_pyramid = tilesource->subifd_pyramid;
+	view->page_pyramid = tilesource->page_pyramid;
+	view->page = tilesource->page;
+	view->n_pages = tilesource->n_pages;
+	view->zoom = tilesource->zoom;
+	view->level_count = tilesource->level_count;
+	memcpy(view->level_width, tilesource->level_width,
+		sizeof(view->level_width));
+	memcpy(view->level_height, tilesource->level_height,
+		sizeof(view->level_height));
+	view->synchronous = tilesource->synchronous;
+	view->priority = tilesource->priority;
+	view->decoded = tilesource->decoded;
+
+	view->active = tilesource->active;
+	view->scale = tilesource->scale;
+	view->offset = tilesource->offset;
+	view->falsecolour = tilesource->falsecolour;
+	view->log = tilesource->log;
+	view->icc = tilesource->icc;
+	view->float_tiles = tilesource->float_tiles;
+
+	view->base = tilesource->base;
+	if (view->base)
+		g_object_ref(view->base);
+	view->preview = tilesource->loaded ?
+		NULL : tilesource_get_preview(tilesource);
+}
+
+static void
+tilesource_view_clear(TilesourceView *view)
+{
+	VIPS_FREE(view->filename);
+	VIPS_FREE(view->cache_filename);
+	VIPS_UNREF(view->base);
+	VIPS_UNREF(view->preview);
+}
+
+/* Open a specified level. Take page (if relevant) from the view.
+ */
+static VipsImage *
+tilesource_view_open(TilesourceView *view, int level)
 {
 	/* We open all pages of toilet roll images. We open ->page of multipage
 	 * images, since pages can vary in size (eg. PDF or TIFF) and we can't
 	 * open everything.
 	 */
-	gboolean all_pages = tilesource->type == TILESOURCE_TYPE_TOILET_ROLL;
+	gboolean all_pages = view->type == TILESOURCE_TYPE_TOILET_ROLL;
 	int n = all_pages ? -1 : 1;
-	int page = all_pages ? 0 : tilesource->page;
+	int page = all_pages ? 0 : view->page;
 
 	VipsImage *image;
 
 	/* We only come here for tiles_source which have something you can reopen.
 	 */
-	g_assert(tilesource->filename);
+	g_assert(view->filename);
 
-	if (vips_isprefix("openslide", tilesource->loader)) {
+	if (view->cache_filename) {
+		/* Our cached pyramid, see tilesource_set_cache(). A single page
+		 * with subifd levels.
+		 */
+		image = vips_image_new_from_file(view->cache_filename,
+			"subifd", level - 1,
+			NULL);
+	}
+	else if (vips_isprefix("openslide", view->loader)) {
 		/* These only have a "level" dimension.
 		 */
-		image = vips_image_new_from_file(tilesource->filename,
+		image = vips_image_new_from_file(view->filename,
 			"level", level,
 			NULL);
 	}
-	else if (vips_isprefix("tiff", tilesource->loader)) {
+	else if (vips_isprefix("tiff", view->loader)) {
 		/* We support three modes: subifd pyramids, page-based
 		 * pyramids, and simple multi-page TIFFs (no pyramid).
 		 */
-		if (tilesource->subifd_pyramid)
+		if (view->subifd_pyramid)
 			/* subifd == -1 means the main image. subifd 0 picks
 			 * the first subifd.
 			 */
-			image = vips_image_new_from_file(tilesource->filename,
+			image = vips_image_new_from_file(view->filename,
 				"page", page,
 				"subifd", level - 1,
 				"n", n,
 				NULL);
-		else if (tilesource->page_pyramid)
+		else if (view->page_pyramid)
 			/* No "n" here since pages are mag levels.
 			 */
-			image = vips_image_new_from_file(tilesource->filename,
+			image = vips_image_new_from_file(view->filename,
 				"page", level,
 				NULL);
 		else
 			/* Pages are regular pages.
 			 */
-			image = vips_image_new_from_file(tilesource->filename,
+			image = vips_image_new_from_file(view->filename,
 				"page", page,
 				"n", n,
 				NULL);
 	}
-	else if (vips_isprefix("jp2k", tilesource->loader)) {
+	else if (vips_isprefix("jp2k", view->loader)) {
 		/* These formats only have "page", no "n".
 		 */
 		if (all_pages)
 			image = NULL;
 		else
-			image = vips_image_new_from_file(tilesource->filename,
+			image = vips_image_new_from_file(view->filename,
 				"page", level,
 				NULL);
 	}
-	else if (vips_isprefix("pdf", tilesource->loader)) {
+	else if (vips_isprefix("pdf", view->loader)) {
 		/* Pages can vary in size, so "n" won't always work.
 		 *
 		 * FIXME ... we should support scale too, see SVG.
 		 */
-		image = vips_image_new_from_file(tilesource->filename,
+		image = vips_image_new_from_file(view->filename,
 			"page", page,
 			"n", n,
 			NULL);
 	}
 
-	else if (vips_isprefix("webp", tilesource->loader) ||
-		vips_isprefix("jxl", tilesource->loader) ||
-		vips_isprefix("gif", tilesource->loader)) {
+	else if (vips_isprefix("webp", view->loader) ||
+		vips_isprefix("jxl", view->loader) ||
+		vips_isprefix("gif", view->loader)) {
 		/* These formats have pages all the same size and support page and n.
 		 */
-		image = vips_image_new_from_file(tilesource->filename,
+		image = vips_image_new_from_file(view->filename,
 			"page", level,
 			"n", n,
 			NULL);
 	}
-	else if (vips_isprefix("svg", tilesource->loader)) {
-		image = vips_image_new_from_file(tilesource->filename,
+	else if (vips_isprefix("svg", view->loader)) {
+		image = vips_image_new_from_file(view->filename,
 			// we need to scale the page by the zoom we picked for this SVG
-			"scale", tilesource->zoom / (1 << level),
+			"scale", view->zoom / (1 << level),
 			NULL);
 	}
 	else
 		/* No page spec support.
 		 */
-		image = vips_image_new_from_file(tilesource->filename, NULL);
+		image = vips_image_new_from_file(view->filename, NULL);
+
+	return image;
+}
+
+/* Open a level with the current tilesource state.
+ */
+static VipsImage *
+tilesource_open(Tilesource *tilesource, int level)
+{
+	TilesourceView view = { 0 };
+	VipsImage *image;
+
+	tilesource_view_init(&view, tilesource);
+	image = tilesource_view_open(&view, level);
+	tilesource_view_clear(&view);
 
 	return image;
 }
 
-/* Run by the main GUI thread when a notify comes in from libvips that a tile
- * we requested is now available.
+/* TRUE if @image is the end of the current pipeline, or of one of the
+ * pipelines we are keeping for other levels.
+ */
+static gboolean
+tilesource_has_image(Tilesource *tilesource, VipsImage *image)
+{
+	if (image == tilesource->image)
+		return TRUE;
+
+	for (GSList *p = tilesource->levels; p; p = p->next) {
+		TilesourceLevel *level = (TilesourceLevel *) p->data;
+
+		if (level->image == image)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Run by the main GUI thread when notifies come in from libvips that tiles
+ * we requested are now available, or when textures have been packed. We
+ * handle everything that has arrived since the last drain in one batch.
  */
 static gboolean
 tilesource_render_notify_idle(void *user_data)
 {
-	TilesourceUpdate *update = (TilesourceUpdate *) user_data;
-	Tilesource *tilesource = update->tilesource;
+	Tilesource *tilesource = TILESOURCE(user_data);
 
-	/* Only bother fetching the updated tile if it's from our current
-	 * pipeline.
+	/* Take the whole stack. Workers will start a new one, and queue a new
+	 * idle for it.
 	 */
-	if (update->image == tilesource->image)
-		tilesource_collect(tilesource, &update->rect, update->z);
+	TilesourceUpdate *updates =
+		g_atomic_pointer_exchange(&tilesource->updates, NULL);
 
-	/* Matches the g_new() in tilesource_render_notify().
+	/* The stack is newest first. Reverse so we collect in the order
+	 * libvips computed them.
 	 */
-	g_free(update);
+	TilesourceUpdate *reversed = NULL;
+	while (updates) {
+		TilesourceUpdate *next = updates->next;
+
+		updates->next = reversed;
+		reversed = updates;
+		updates = next;
+	}
+
+	if (reversed) {
+		for (TilesourceUpdate *p = reversed; p; p = p->next) {
+			if (!p->tile) {
+				/* Only bother fetching the updated tile if it's from one
+				 * of our pipelines.
+				 */
+				if (tilesource_has_image(tilesource, p->image))
+					tilesource_collect(tilesource, &p->rect, p->z);
+
+				continue;
+			}
+
+			if (p->tile->pack_serial == p->serial)
+				p->tile->pack_serial = 0;
+
+			/* Drop the texture if the tile has been invalidated or
+			 * dropped by its tilecache since the pack was queued.
+			 */
+			if (p->texture &&
+				p->tile->tilecache &&
+				p->serial == p->tile->serial) {
+				tile_set_texture(p->tile, p->texture,
+					p->scale, p->offset);
+				tilesource_collect(tilesource, &p->rect, p->z);
+			}
+		}
+
+		tilesource_collect_done(tilesource);
+	}
+
+	tilesource_free_updates(reversed);
 
 	return FALSE;
 }
 
+/* Push an update onto the tilesource's stack. This can run from any thread.
+ * The first update onto an empty stack adds an idle callback which the main
+ * thread will run when it next hits the mainloop.
+ */
+static void
+tilesource_push_update(Tilesource *tilesource, TilesourceUpdate *update)
+{
+	/* The main thread only ever takes the whole stack, so there's no ABA
+	 * problem.
+	 */
+	TilesourceUpdate *head;
+	do {
+		head = g_atomic_pointer_get(&tilesource->updates);
+		update->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(&tilesource->updates,
+		head, update));
+
+	if (!head)
+		g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+			tilesource_render_notify_idle,
+			g_object_ref(tilesource), g_object_unref);
+}
+
 /* Come here from the vips_sink_screen() background thread when a tile has been
- * calculated. This is a background thread, so we add an idle callback
- * which will be run by the main thread when it next hits the mainloop.
+ * calculated. This is a background thread, so we push the tile onto the
+ * tilesource's stack of updates.
  */
 static void
 tilesource_render_notify(VipsImage *image, VipsRect *rect, void *client)
@@ -268,29 +688,191 @@ tilesource_render_notify(VipsImage *image, VipsRect *rect, void *client)
 	/* We're passed an update made by tilesource_image() to track
 	 * just this image. We need one dedicated to this single event.
 	 */
-	TilesourceUpdate *new_update = g_new(TilesourceUpdate, 1);
+	TilesourceUpdate *new_update = g_new0(TilesourceUpdate, 1);
 
 	/* From image cods to level0 cods.
 	 */
-	*new_update = *update;
+	new_update->tilesource = update->tilesource;
+	new_update->image = update->image;
+	new_update->z = update->z;
 	new_update->rect.left = rect->left << update->z;
 	new_update->rect.top = rect->top << update->z;
 	new_update->rect.width = rect->width << update->z;
 	new_update->rect.height = rect->height << update->z;
 
-	g_idle_add(tilesource_render_notify_idle, new_update);
+	tilesource_push_update(update->tilesource, new_update);
+}
+
+/* This runs for the pack threadpool. We make our own regions, so the main
+ * thread can carry on using the tilesource ones.
+ */
+static void
+tilesource_pack_worker(void *data, void *user_data)
+{
+	TilesourcePack *pack = (TilesourcePack *) data;
+
+	/* The update takes over the refs the pack holds on the tile and
+	 * tilesource, so they are only ever unreffed on the main thread.
+	 */
+	TilesourceUpdate *update = g_new0(TilesourceUpdate, 1);
+	update->tilesource = pack->tilesource;
+	update->tile = pack->tile;
+	update->serial = pack->serial;
+	update->scale = pack->scale;
+	update->offset = pack->offset;
+	update->rect = pack->tile->bounds0;
+	update->z = pack->tile->z;
+
+	VipsRegion *mask_region = vips_region_new(pack->mask);
+	VipsRegion *rgb_region = vips_region_new(pack->rgb);
+
+	/* The pixels might have dropped out of the libvips cache since the
+	 * main thread looked. Fetching the rgb will queue a recompute, and
+	 * the tile will be collected again when that arrives.
+	 */
+	if (!vips_region_prepare(mask_region, &pack->hit)) {
+		gboolean valid = VIPS_REGION_ADDR(mask_region,
+			pack->hit.left, pack->hit.top)[0];
+
+		if (!vips_region_prepare(rgb_region, &pack->hit) &&
+			valid)
+			update->texture = tile_texture_new(rgb_region);
+	}
+
+	VIPS_UNREF(mask_region);
+	VIPS_UNREF(rgb_region);
+	VIPS_UNREF(pack->mask);
+	VIPS_UNREF(pack->rgb);
+	g_free(pack);
+
+	tilesource_push_update(update->tilesource, update);
+}
+
+/* Queue a tile with valid pixels for packing into a texture, unless there's
+ * already a pack on the way.
+ */
+static void
+tilesource_pack(Tilesource *tilesource, Tile *tile, VipsRect *hit)
+{
+	if (tile->pack_serial == tile->serial)
+		return;
+
+	TilesourcePack *pack = g_new(TilesourcePack, 1);
+	pack->tilesource = g_object_ref(tilesource);
+	pack->tile = g_object_ref(tile);
+	pack->serial = tile->serial;
+	pack->scale = tilesource->rgb_scale;
+	pack->offset = tilesource->rgb_offset;
+	pack->rgb = g_object_ref(tilesource->rgb);
+	pack->mask = g_object_ref(tilesource->mask);
+	pack->hit = *hit;
+
+	tile->pack_serial = tile->serial;
+
+	g_thread_pool_push(tilesource_pack_pool, pack, NULL);
+}
+
+/* Each level of a generated pyramid caches at least this many tiles.
+ */
+#define TILESOURCE_PYRAMID_MIN_TILES (16)
+
+/* Level @z of a pyramid over @image, a level0 image with no pyramid of its
+ * own. Each level is made from the one below with a 2x2 box shrink and
+ * memoised with a tile cache, and the levels are shared by the pipelines for
+ * each z, so zooming out reads each source pixel once, rather than every
+ * source tile for every level.
+ *
+ * Level z caches up to tilesource_pyramid_memory >> z bytes, so the whole
+ * pyramid stays inside that. Levels are cropped to the half-size (rounding
+ * down) that tilecache expects.
+ *
+ * Reopening a file gives the same image from the libvips operation cache,
+ * so we can key the pyramid on @image. This can run in the background.
+ */
+static VipsImage *
+tilesource_pyramid_level(Tilesource *tilesource, VipsImage *image, int z)
+{
+	VipsImage *x;
+	VipsImage *y;
+
+	g_mutex_lock(&tilesource->pyramid_lock);
+
+	if (tilesource->pyramid[0] != image) {
+		tilesource_free_pyramid(tilesource);
+		tilesource->pyramid[0] = image;
+		g_object_ref(image);
+	}
+
+	for (int i = 1; i <= z; i++)
+		if (!tilesource->pyramid[i]) {
+			VipsImage *below = tilesource->pyramid[i - 1];
+
+			int width = VIPS_MAX(1, below->Xsize >> 1);
+			int height = VIPS_MAX(1, below->Ysize >> 1);
+			gsize tile_bytes = (gsize) TILE_SIZE * TILE_SIZE *
+				VIPS_IMAGE_SIZEOF_PEL(below);
+			int max_tiles = VIPS_MAX(TILESOURCE_PYRAMID_MIN_TILES,
+				(tilesource_pyramid_memory >> i) / tile_bytes);
+			VipsImage *shrunk;
+
+			if (vips_shrink(below, &shrunk,
+					below->Xsize > 1 ? 2 : 1,
+					below->Ysize > 1 ? 2 : 1,
+					NULL)) {
+				g_mutex_unlock(&tilesource->pyramid_lock);
+				return NULL;
+			}
+
+			/* vips_shrink() rounds odd sizes up.
+			 */
+			if (vips_crop(shrunk, &x, 0, 0,
+					VIPS_MIN(width, shrunk->Xsize),
+					VIPS_MIN(height, shrunk->Ysize),
+					NULL)) {
+				VIPS_UNREF(shrunk);
+				g_mutex_unlock(&tilesource->pyramid_lock);
+				return NULL;
+			}
+			VIPS_UNREF(shrunk);
+
+			if (vips_tilecache(x, &y,
+					"tile_width", TILE_SIZE,
+					"tile_height", TILE_SIZE,
+					"max_tiles", max_tiles,
+					"threaded", TRUE,
+					NULL)) {
+				VIPS_UNREF(x);
+				g_mutex_unlock(&tilesource->pyramid_lock);
+				return NULL;
+			}
+			VIPS_UNREF(x);
+
+			tilesource->pyramid[i] = y;
+		}
+
+	x = tilesource->pyramid[z];
+	g_object_ref(x);
+
+	g_mutex_unlock(&tilesource->pyramid_lock);
+
+	return x;
 }
 
 /* Build the first half of the render pipeline, from @base (or filename) to
- * @image.
+ * @image, and get the size of the level0 image in the current view mode.
  *
- * This ends in the sink_screen which will issue any repaints.
+ * This ends in the sink_screen which will issue any repaints. This can run
+ * in a background thread, so it must not change @tilesource, and reads
+ * everything it needs from @view.
  */
 static VipsImage *
-tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
+tilesource_image(Tilesource *tilesource, TilesourceView *view,
+	VipsImage **mask_out, int *width_out, int *height_out, int current_z)
 {
 	VipsImage *x;
 	VipsImage *mask;
+	int image_width;
+	int image_height;
 
 	g_assert(mask_out);
 
@@ -302,34 +884,48 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 
 	/* Open the image with any shrink-on-load tricks.
 	 */
-	if (tilesource->type == TILESOURCE_TYPE_IMAGE) {
-		/* We are displaying a VipsImage* and there's no reopen possible.
+	if (view->type == TILESOURCE_TYPE_IMAGE ||
+		(view->decoded &&
+			!view->cache_filename)) {
+		/* We are displaying a VipsImage*, or pixels we decoded ourselves
+		 * and have no cached pyramid for yet, and there's no reopen
+		 * possible.
+		 */
+		image = view->base;
+		g_object_ref(image);
+
+		image_width = image->Xsize;
+		image_height = image->Ysize;
+	}
+	else if (view->preview) {
+		/* Still loading, show the rows we've decoded so far, see
+		 * tilesource_decode_start().
 		 */
-		image = tilesource->base;
+		image = view->preview;
 		g_object_ref(image);
 
-		tilesource->image_width = image->Xsize;
-		tilesource->image_height = image->Ysize;
+		image_width = image->Xsize;
+		image_height = image->Ysize;
 	}
-	else if (tilesource->level_count > 1) {
+	else if (view->level_count > 1) {
 		/* There's a pyr, load the best level. This will open all pages, if
 		 * possible.
 		 */
-		int required_width = tilesource->level_width[0] >> current_z;
+		int required_width = view->level_width[0] >> current_z;
 
 		int i;
 		int level;
 
-		for (i = 0; i < tilesource->level_count; i++)
-			if (tilesource->level_width[i] < required_width)
+		for (i = 0; i < view->level_count; i++)
+			if (view->level_width[i] < required_width)
 				break;
-		level = VIPS_CLIP(0, i - 1, tilesource->level_count - 1);
+		level = VIPS_CLIP(0, i - 1, view->level_count - 1);
 
-		if (!(image = tilesource_open(tilesource, level)))
+		if (!(image = tilesource_view_open(view, level)))
 			return NULL;
 
-		tilesource->image_width = tilesource->level_width[0];
-		tilesource->image_height = tilesource->level_height[0];
+		image_width = view->level_width[0];
+		image_height = view->level_height[0];
 
 #ifdef DEBUG
 		printf("\tloading level %d\n", level);
@@ -341,24 +937,24 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 		/* A non-pyramidal image from a file.
 		 */
 
-		// will open all pages, or tilesource->page if this is a multipage
+		// will open all pages, or view->page if this is a multipage
 		// image whose pages vary in size
-		if (!(image = tilesource_open(tilesource, 0)))
+		if (!(image = tilesource_view_open(view, 0)))
 			return NULL;
 
-		tilesource->image_width = image->Xsize;
-		tilesource->image_height = image->Ysize;
+		image_width = image->Xsize;
+		image_height = image->Ysize;
 
 #ifdef DEBUG
-		printf("\tloading page %d\n", tilesource->page);
+		printf("\tloading page %d\n", view->page);
 		printf("\t(image->Xsize = %d, image->Ysize = %d)\n",
 			image->Xsize, image->Ysize);
 #endif /*DEBUG*/
 	}
 
 #ifdef DEBUG
-	printf("\timage_width = %d\n", tilesource->image_width);
-	printf("\timage_height = %d\n", tilesource->image_height);
+	printf("\timage_width = %d\n", image_width);
+	printf("\timage_height = %d\n", image_height);
 #endif /*DEBUG*/
 
 	/* If we have a toilet roll source and we are displaying multipage or
@@ -367,9 +963,9 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 	 * We need to crop using the page size on image, since it might have
 	 * been shrunk by shrink-on-load above ^^
 	 */
-	if (tilesource->type == TILESOURCE_TYPE_TOILET_ROLL &&
-		(tilesource->mode == TILESOURCE_MODE_MULTIPAGE ||
-		 tilesource->mode == TILESOURCE_MODE_ANIMATED)) {
+	if (view->type == TILESOURCE_TYPE_TOILET_ROLL &&
+		(view->mode == TILESOURCE_MODE_MULTIPAGE ||
+		 view->mode == TILESOURCE_MODE_ANIMATED)) {
 		// loaders will adjust page_height for shrink-on-load, so we can just
 		// use that
 		int page_height = vips_image_get_page_height(image);
@@ -377,17 +973,17 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 		VipsImage *x;
 
 		if (vips_crop(image, &x,
-				0, tilesource->page * page_height,
+				0, view->page * page_height,
 				image->Xsize, page_height, NULL))
 			return NULL;
 		VIPS_UNREF(image);
 		image = x;
 
 		// only showing one page now
-		tilesource->image_height /= tilesource->n_pages;
+		image_height /= view->n_pages;
 
 #ifdef DEBUG
-		printf("\tcropping page %d\n", tilesource->page);
+		printf("\tcropping page %d\n", view->page);
 		printf("\t(image->Xsize = %d, image->Ysize = %d)\n",
 			image->Xsize, image->Ysize);
 #endif /*DEBUG*/
@@ -395,14 +991,14 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 
 	/* In pages-as-bands mode, crop out all pages and join band-wise.
 	 */
-	if (tilesource->type == TILESOURCE_TYPE_TOILET_ROLL &&
-		tilesource->mode == TILESOURCE_MODE_PAGES_AS_BANDS) {
+	if (view->type == TILESOURCE_TYPE_TOILET_ROLL &&
+		view->mode == TILESOURCE_MODE_PAGES_AS_BANDS) {
 		// loaders will adjust page_height for shrink-on-load, so we can just
 		// use that
 		int page_height = vips_image_get_page_height(image);
 
 		// there's probably no alpha, so just go to rgb or mono
-		int n_pages = tilesource->n_pages >= 3 ? 3 : 1;
+		int n_pages = view->n_pages >= 3 ? 3 : 1;
 
 		g_autoptr(VipsObject) context = VIPS_OBJECT(vips_image_new());
 		VipsImage **t = (VipsImage **)
@@ -441,7 +1037,7 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 		}
 
 		// only showing one page now
-		tilesource->image_height /= tilesource->n_pages;
+		image_height /= view->n_pages;
 
 #ifdef DEBUG
 		printf("\tjoining n_pages %d\n", n_pages);
@@ -468,16 +1064,27 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 		image = t[3];
 		g_object_ref(image);
 
-		tilesource->image_height = image->Ysize;
+		image_height = image->Ysize;
 	}
 
-	if (current_z > 0) {
+	if (current_z > 0 &&
+		view->level_count <= 1) {
+		/* No pyramid in the source, use our own. While we're loading,
+		 * tiles are only requested from rows we have, so the cached
+		 * shrinks never see missing rows.
+		 */
+		if (!(x = tilesource_pyramid_level(tilesource, image, current_z)))
+			return NULL;
+		VIPS_UNREF(image);
+		image = x;
+	}
+	else if (current_z > 0) {
         /* We may have already zoomed out a bit because we've loaded
          * some layer other than the base one. Calculate the
          * subsample as (current_width / required_width).
          */
-        int width = VIPS_MAX(1, tilesource->image_width >> current_z);
-        int height = VIPS_MAX(1, tilesource->image_height >> current_z);
+        int width = VIPS_MAX(1, image_width >> current_z);
+        int height = VIPS_MAX(1, image_height >> current_z);
         int xfac = VIPS_MAX(1, image->Xsize / width);
         int yfac = VIPS_MAX(1, image->Ysize / height);
 
@@ -487,7 +1094,7 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 		image = x;
 	}
 
-	if (tilesource->synchronous) {
+	if (view->synchronous) {
 		if (vips_copy(image, &x, NULL))
 			return NULL;
 		VIPS_UNREF(image);
@@ -505,7 +1112,7 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 		x = vips_image_new();
 		mask = vips_image_new();
 		if (vips_sink_screen(image, x, mask,
-				TILE_SIZE, TILE_SIZE, MAX_TILES, tilesource->priority,
+				TILE_SIZE, TILE_SIZE, MAX_TILES, view->priority,
 				tilesource_render_notify, update)) {
 			VIPS_UNREF(x);
 			VIPS_UNREF(mask);
@@ -520,19 +1127,26 @@ tilesource_image(Tilesource *tilesource, VipsImage **mask_out, int current_z)
 	}
 
 #ifdef DEBUG
-	printf("\timage_width = %d\n", tilesource->image_width);
-	printf("\timage_height = %d\n", tilesource->image_height);
+	printf("\timage_width = %d\n", image_width);
+	printf("\timage_height = %d\n", image_height);
 	printf("\timage->Xsize = %d\n", image->Xsize);
 	printf("\timage->Ysize = %d\n", image->Ysize);
 #endif /*DEBUG*/
 
+	*width_out = image_width;
+	*height_out = image_height;
+
 	return g_steal_pointer(&image);
 }
 
+/* The log display curve, mapping 0 - 255 to 0 - 255.
+ */
+#define TILESOURCE_LOG_POWER (0.25)
+
 static VipsImage *
 tilesource_log(VipsImage *image)
 {
-	static const double power = 0.25;
+	const double power = TILESOURCE_LOG_POWER;
 	const double scale = 255.0 / log10(1.0 + pow(255.0, power));
 
 	g_autoptr(VipsObject) context = VIPS_OBJECT(vips_image_new());
@@ -559,6 +1173,18 @@ tilesource_log(VipsImage *image)
 	return image;
 }
 
+/* The curve tilesource_log() applies, for a painter that does log at draw
+ * time.
+ */
+double
+tilesource_log_value(double v)
+{
+	const double power = TILESOURCE_LOG_POWER;
+	const double scale = 255.0 / log10(1.0 + pow(255.0, power));
+
+	return scale * log10(1.0 + pow(v, power));
+}
+
 static int
 tilesource_n_colour(VipsImage *image)
 {
@@ -591,21 +1217,127 @@ tilesource_n_colour(VipsImage *image)
 	}
 }
 
-/* Build the second half of the image pipeline. This ends with an 8-bit
- * RGB or RGBA image we can use to make textures.
+/* Plain mono or RGB, with no colour conversion needed for display.
  */
-static VipsImage *
-tilesource_rgb(Tilesource *tilesource, VipsImage *in)
+static gboolean
+tilesource_is_plain(VipsImage *image)
 {
-	VipsImage *x;
-	int n_bands;
+	VipsInterpretation type = vips_image_guess_interpretation(image);
+
+	return image->Coding == VIPS_CODING_NONE &&
+		!vips_band_format_iscomplex(image->BandFmt) &&
+		(type == VIPS_INTERPRETATION_B_W ||
+			type == VIPS_INTERPRETATION_GREY16 ||
+			type == VIPS_INTERPRETATION_sRGB ||
+			type == VIPS_INTERPRETATION_RGB16);
+}
 
-	g_autoptr(VipsImage) image = in;
-	g_object_ref(image);
+/* Does the scale and offset commute with the rest of the display
+ * pipeline? The only display transform must be the linear one, so it can be
+ * done at draw time.
+ */
+static gboolean
+tilesource_is_linear(TilesourceView *view, VipsImage *image)
+{
+	return tilesource_is_plain(image) &&
+		!(view->active &&
+			(view->falsecolour ||
+				view->log ||
+				view->icc));
+}
 
-	/* Coded images won't unalpha correctly.
-	 */
-	if (vips_image_decode(image, &x))
+/* Can the painter do scale, offset and log for us? We need a gtk with
+ * component transfer nodes, and 8-bit mono or RGB, since the log curve
+ * works on 0 - 255.
+ */
+static gboolean
+tilesource_can_transfer(TilesourceView *view, VipsImage *image)
+{
+#ifdef HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER
+	VipsInterpretation type = vips_image_guess_interpretation(image);
+
+	return !view->float_tiles &&
+		tilesource_is_plain(image) &&
+		image->BandFmt == VIPS_FORMAT_UCHAR &&
+		(type == VIPS_INTERPRETATION_B_W ||
+			type == VIPS_INTERPRETATION_sRGB) &&
+		!(view->active &&
+			(view->falsecolour ||
+				view->icc));
+#else /*!HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER*/
+	return FALSE;
+#endif /*HAVE_GTK_SNAPSHOT_PUSH_COMPONENT_TRANSFER*/
+}
+
+/* The scale and offset the display pipeline applies.
+ */
+static void
+tilesource_get_linear(Tilesource *tilesource, double *scale, double *offset)
+{
+	if (tilesource->active) {
+		*scale = tilesource->scale;
+		*offset = tilesource->offset;
+	}
+	else {
+		*scale = 1.0;
+		*offset = 0.0;
+	}
+}
+
+/* Scale to float 0 - 1, with scale and offset left for draw time.
+ */
+static VipsImage *
+tilesource_rgb_float(TilesourceView *view, VipsImage *in, double *rgb_max)
+{
+	VipsImage *x;
+
+	g_autoptr(VipsImage) image = in;
+	g_object_ref(image);
+
+	image->Type = vips_image_guess_interpretation(image);
+	*rgb_max = vips_interpretation_max_alpha(image->Type);
+
+	/* Drop any extra bands, but keep the first alpha.
+	 */
+	int n_bands = tilesource_n_colour(image);
+	if (image->Bands > n_bands + 1) {
+		if (vips_extract_band(image, &x, 0, "n", n_bands + 1, NULL))
+			return NULL;
+		VIPS_UNREF(image);
+		image = x;
+	}
+
+	if (vips_linear1(image, &x, 1.0 / *rgb_max, 0.0, NULL))
+		return NULL;
+	VIPS_UNREF(image);
+	image = x;
+
+	/* linear makes double from double, and tiles must be float.
+	 */
+	if (vips_cast_float(image, &x, NULL))
+		return NULL;
+	VIPS_UNREF(image);
+	image = x;
+
+	return g_steal_pointer(&image);
+}
+
+/* Build the second half of the image pipeline. This ends with an 8-bit
+ * RGB or RGBA image we can use to make textures.
+ */
+static VipsImage *
+tilesource_rgb(TilesourceView *view, VipsImage *in,
+	gboolean rgb_transfer, double *rgb_max)
+{
+	VipsImage *x;
+	int n_bands;
+
+	g_autoptr(VipsImage) image = in;
+	g_object_ref(image);
+
+	/* Coded images won't unalpha correctly.
+	 */
+	if (vips_image_decode(image, &x))
 		return NULL;
 	VIPS_UNREF(image);
 	image = x;
@@ -614,6 +1346,7 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 	 * srgb) and that'll mess up our rules for display.
 	 */
 	image->Type = vips_image_guess_interpretation(image);
+	*rgb_max = vips_interpretation_max_alpha(image->Type);
 
 	/* We don't want vis controls to touch alpha ... remove and reattach at
 	 * the end.
@@ -634,23 +1367,25 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 
 	/* Visualisation controls ... the scale and offset values must be applied
 	 * to the original image values, so this has to be before we go to RGB.
+	 * They are left to the painter for rgb_transfer.
 	 */
-	if (tilesource->active &&
-		(tilesource->scale != 1.0 ||
-			tilesource->offset != 0.0 ||
-			tilesource->falsecolour ||
-			tilesource->log)) {
-		if (tilesource->log) {
+	if (view->active &&
+		!rgb_transfer &&
+		(view->scale != 1.0 ||
+			view->offset != 0.0 ||
+			view->falsecolour ||
+			view->log)) {
+		if (view->log) {
 			if (!(x = tilesource_log(image)))
 				return NULL;
 			VIPS_UNREF(image);
 			image = x;
 		}
 
-		if (tilesource->scale != 1.0 ||
-			tilesource->offset != 0.0) {
+		if (view->scale != 1.0 ||
+			view->offset != 0.0) {
 			if (vips_linear1(image, &x,
-					tilesource->scale, tilesource->offset, NULL))
+					view->scale, view->offset, NULL))
 				return NULL;
 			VIPS_UNREF(image);
 			image = x;
@@ -675,19 +1410,24 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 
 	/* Colour management to srgb.
 	 */
-	if (tilesource->active &&
-		tilesource->icc) {
+	if (view->active &&
+		view->icc) {
 		if (vips_icc_transform(image, &x, "srgb", NULL))
 			return NULL;
 		VIPS_UNREF(image);
 		image = x;
 	}
 
-	/* Go to uint8 sRGB in a nice way.
+	/* Go to uint8 sRGB in a nice way. Mono images stay mono, so we can
+	 * make one-band textures.
 	 */
-	if (image->Type != VIPS_INTERPRETATION_sRGB &&
+	VipsInterpretation target = image->Bands == 1 &&
+			(image->Type == VIPS_INTERPRETATION_B_W ||
+				image->Type == VIPS_INTERPRETATION_GREY16) ?
+		VIPS_INTERPRETATION_B_W : VIPS_INTERPRETATION_sRGB;
+	if (image->Type != target &&
 		vips_colourspace_issupported(image)) {
-		if (vips_colourspace(image, &x, VIPS_INTERPRETATION_sRGB, NULL))
+		if (vips_colourspace(image, &x, target, NULL))
 			return NULL;
 		VIPS_UNREF(image);
 		image = x;
@@ -700,10 +1440,10 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 		image = x;
 	}
 
-	/* This must be after conversion to sRGB.
+	/* This must be after conversion to sRGB. It makes a mono image RGB.
 	 */
-	if (tilesource->active &&
-		tilesource->falsecolour) {
+	if (view->active &&
+		view->falsecolour) {
 		if (vips_falsecolour(image, &x, NULL))
 			return NULL;
 		VIPS_UNREF(image);
@@ -711,7 +1451,7 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 	}
 
 	/* The number of bands could still be wrong for spaces like
-	 * MATRIX or FOURIER.
+	 * MATRIX or FOURIER. One band is fine, we display that as mono.
 	 */
 	if (image->Bands > 3) {
 		if (vips_extract_band(image, &x, 0, "n", 3, NULL))
@@ -725,14 +1465,6 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 		VIPS_UNREF(image);
 		image = x;
 	}
-	else if (image->Bands == 1) {
-		VipsImage *in[3] = { image, image, image };
-
-		if (vips_bandjoin(in, &x, 3, NULL))
-			return NULL;
-		VIPS_UNREF(image);
-		image = x;
-	}
 
 	// reattach alpha
 	if (alpha) {
@@ -761,88 +1493,378 @@ tilesource_rgb(Tilesource *tilesource, VipsImage *in)
 	return g_steal_pointer(&image);
 }
 
-/* Rebuild just the second half of the image pipeline, eg. after a change to
- * falsecolour, scale, or if current_z changes.
+/* Build the rgb half of a pipeline from @image, the output of
+ * tilesource_image(). This only reads the view, so it can run in the
+ * background.
  */
 static int
-tilesource_update_rgb(Tilesource *tilesource)
+tilesource_view_rgb(TilesourceView *view, VipsImage *image, TilesourceRgb *rgb)
+{
+	rgb->rgb_transfer = tilesource_can_transfer(view, image);
+	rgb->rgb_linear = rgb->rgb_transfer ||
+		tilesource_is_linear(view, image);
+	rgb->rgb_float = rgb->rgb_linear && view->float_tiles;
+
+	if (!(rgb->rgb = rgb->rgb_float ?
+			tilesource_rgb_float(view, image, &rgb->rgb_max) :
+			tilesource_rgb(view, image,
+				rgb->rgb_transfer, &rgb->rgb_max)))
+		return -1;
+
+	if (rgb->rgb_float ||
+		rgb->rgb_transfer ||
+		!view->active) {
+		rgb->rgb_scale = 1.0;
+		rgb->rgb_offset = 0.0;
+	}
+	else {
+		rgb->rgb_scale = view->scale;
+		rgb->rgb_offset = view->offset;
+	}
+
+	return 0;
+}
+
+/* Make @rgb the rgb half of the current pipeline. We take ownership of the
+ * ref.
+ */
+static void
+tilesource_set_rgb(Tilesource *tilesource, TilesourceRgb *rgb)
+{
+	VIPS_UNREF(tilesource->rgb);
+	VIPS_UNREF(tilesource->rgb_region);
+
+	tilesource->rgb = g_steal_pointer(&rgb->rgb);
+	tilesource->rgb_float = rgb->rgb_float;
+	tilesource->rgb_linear = rgb->rgb_linear;
+	tilesource->rgb_transfer = rgb->rgb_transfer;
+	tilesource->rgb_max = rgb->rgb_max;
+	tilesource->rgb_scale = rgb->rgb_scale;
+	tilesource->rgb_offset = rgb->rgb_offset;
+
+	tilesource->rgb_region = vips_region_new(tilesource->rgb);
+	vips__region_no_ownership(tilesource->rgb_region);
+}
+
+/* Build the second half of the pipeline for the current level.
+ */
+static int
+tilesource_build_rgb(Tilesource *tilesource)
 {
 #ifdef DEBUG
-	printf("tilesource_update_rgb:\n");
+	printf("tilesource_build_rgb:\n");
 #endif /*DEBUG*/
 
 	if (tilesource->image) {
-		VipsImage *rgb;
+		TilesourceView view = { 0 };
+		TilesourceRgb rgb = { 0 };
 
-		if (!(rgb = tilesource_rgb(tilesource, tilesource->image))) {
-			printf("tilesource_rgb failed!\n");
+		tilesource_view_init(&view, tilesource);
+		int result = tilesource_view_rgb(&view, tilesource->image, &rgb);
+		tilesource_view_clear(&view);
+		if (result) {
+#ifdef DEBUG
+			printf("tilesource_build_rgb: build failed\n");
+#endif /*DEBUG*/
 			return -1;
 		}
-		VIPS_UNREF(tilesource->rgb);
-		tilesource->rgb = rgb;
 
-		VIPS_UNREF(tilesource->rgb_region);
-		tilesource->rgb_region = vips_region_new(tilesource->rgb);
-		vips__region_no_ownership(tilesource->rgb_region);
+		tilesource_set_rgb(tilesource, &rgb);
+	}
+
+	return 0;
+}
+
+/* Make @image and @mask the first half of the current pipeline. We take
+ * ownership of the refs.
+ */
+static void
+tilesource_set_image_half(Tilesource *tilesource,
+	VipsImage *image, VipsImage *mask)
+{
+	VIPS_UNREF(tilesource->image);
+	VIPS_UNREF(tilesource->mask);
+	VIPS_UNREF(tilesource->image_region);
+	VIPS_UNREF(tilesource->mask_region);
+
+	tilesource->image = image;
+	tilesource->image_region = vips_region_new(tilesource->image);
+	vips__region_no_ownership(tilesource->image_region);
+
+	// can be NULL for synchronous images
+	if (mask) {
+		tilesource->mask = mask;
+		tilesource->mask_region = vips_region_new(mask);
+		vips__region_no_ownership(tilesource->mask_region);
 	}
+}
+
+/* Make @image and @mask the current pipeline, and rebuild the rgb half.
+ * We take ownership of the refs.
+ */
+static int
+tilesource_set_image(Tilesource *tilesource, VipsImage *image, VipsImage *mask)
+{
+	tilesource_set_image_half(tilesource, image, mask);
+
+	// update downstream as well
+	if (tilesource_build_rgb(tilesource))
+		return -1;
 
 	return 0;
 }
 
-/* Rebuild the entire display pipeline eg. after a page flip, or if current_z
- * changes, or mode changes.
+/* Build the entire display pipeline for the current level.
  */
 static int
-tilesource_update_image(Tilesource *tilesource)
+tilesource_build_image(Tilesource *tilesource)
 {
 	VipsImage *image;
 	VipsImage *mask;
 
 #ifdef DEBUG
-	printf("tilesource_update_image:\n");
+	printf("tilesource_build_image:\n");
 #endif /*DEBUG*/
 
-	/* Don't update if we're still loading.
+	/* Don't update if we're still loading, unless there's a preview.
 	 */
-	if (!tilesource->loaded ||
+	if ((!tilesource->loaded &&
+			!tilesource->preview) ||
 		!tilesource->base)
 		return 0;
 
-	if (!(image = tilesource_image(tilesource, &mask, tilesource->current_z))) {
+	TilesourceView view = { 0 };
+	tilesource_view_init(&view, tilesource);
+	image = tilesource_image(tilesource, &view, &mask,
+		&tilesource->image_width, &tilesource->image_height,
+		tilesource->current_z);
+	tilesource_view_clear(&view);
+	if (!image) {
 #ifdef DEBUG
-		printf("tilesource_update_image: build failed\n");
+		printf("tilesource_build_image: build failed\n");
 #endif /*DEBUG*/
 		return -1;
 	}
 
 #ifdef DEBUG
-	printf("tilesource_update_image: new image of %d x %d\n",
+	printf("tilesource_build_image: new image of %d x %d\n",
 		image->Xsize, image->Ysize);
 #endif /*DEBUG*/
 
-	VIPS_UNREF(tilesource->image);
-	VIPS_UNREF(tilesource->mask);
-	VIPS_UNREF(tilesource->image_region);
-	VIPS_UNREF(tilesource->mask_region);
+	return tilesource_set_image(tilesource, image, mask);
+}
 
-	tilesource->image = image;
-	tilesource->image_region = vips_region_new(tilesource->image);
-	vips__region_no_ownership(tilesource->image_region);
+/* Rebuild just the second half of the image pipeline, eg. after a change to
+ * falsecolour or scale. Pipelines for other levels are out of date.
+ */
+static int
+tilesource_update_rgb(Tilesource *tilesource)
+{
+	tilesource_free_levels(tilesource);
+	tilesource->build_serial += 1;
 
-	// can be NULL for synchronous images
-	if (mask) {
-		tilesource->mask = mask;
-		tilesource->mask_region = vips_region_new(mask);
-		vips__region_no_ownership(tilesource->mask_region);
+	return tilesource_build_rgb(tilesource);
+}
+
+/* Rebuild the entire display pipeline eg. after a page flip, or if mode
+ * changes.
+ */
+static int
+tilesource_update_image(Tilesource *tilesource)
+{
+	tilesource_free_levels(tilesource);
+	tilesource->build_serial += 1;
+
+	return tilesource_build_image(tilesource);
+}
+
+/* Move the current pipeline to the set of levels, dropping the least
+ * recently used.
+ */
+static void
+tilesource_level_stash(Tilesource *tilesource)
+{
+	if (!tilesource->image)
+		return;
+
+	TilesourceLevel *level = g_new0(TilesourceLevel, 1);
+	level->z = tilesource->current_z;
+	level->image = g_steal_pointer(&tilesource->image);
+	level->mask = g_steal_pointer(&tilesource->mask);
+	level->image_region = g_steal_pointer(&tilesource->image_region);
+	level->mask_region = g_steal_pointer(&tilesource->mask_region);
+	level->rgb = g_steal_pointer(&tilesource->rgb);
+	level->rgb_region = g_steal_pointer(&tilesource->rgb_region);
+
+	tilesource->levels = g_slist_prepend(tilesource->levels, level);
+
+	if (g_slist_length(tilesource->levels) >= TILESOURCE_LEVELS) {
+		GSList *last = g_slist_last(tilesource->levels);
+
+		tilesource_level_free((TilesourceLevel *) last->data);
+		tilesource->levels = g_slist_delete_link(tilesource->levels, last);
 	}
+}
 
-	// update downstream as well
-	if (tilesource_update_rgb(tilesource))
-		return -1;
+static TilesourceLevel *
+tilesource_level_find(Tilesource *tilesource, int z)
+{
+	for (GSList *p = tilesource->levels; p; p = p->next) {
+		TilesourceLevel *level = (TilesourceLevel *) p->data;
+
+		if (level->z == z)
+			return level;
+	}
+
+	return NULL;
+}
+
+/* TRUE if we have a pipeline for @z, current or kept.
+ */
+static gboolean
+tilesource_has_z(Tilesource *tilesource, int z)
+{
+	return (tilesource->image &&
+			   tilesource->current_z == z) ||
+		tilesource_level_find(tilesource, z);
+}
+
+/* Make @z the current level, reusing a pipeline we've kept if possible.
+ */
+static int
+tilesource_set_z(Tilesource *tilesource, int z)
+{
+	TilesourceLevel *level;
+
+	if (tilesource->image &&
+		tilesource->current_z == z)
+		return 0;
+
+#ifdef DEBUG
+	printf("tilesource_set_z: %d\n", z);
+#endif /*DEBUG*/
+
+	if ((level = tilesource_level_find(tilesource, z)))
+		tilesource->levels = g_slist_remove(tilesource->levels, level);
+
+	tilesource_level_stash(tilesource);
+	tilesource->current_z = z;
+
+	if (!level)
+		return tilesource_build_image(tilesource);
+
+	tilesource->image = level->image;
+	tilesource->mask = level->mask;
+	tilesource->image_region = level->image_region;
+	tilesource->mask_region = level->mask_region;
+	tilesource->rgb = level->rgb;
+	tilesource->rgb_region = level->rgb_region;
+	g_free(level);
 
 	return 0;
 }
 
+/* This runs in the main thread when a background build of a level is done.
+ */
+static gboolean
+tilesource_build_done_idle(void *user_data)
+{
+	TilesourceBuild *build = (TilesourceBuild *) user_data;
+	Tilesource *tilesource = build->tilesource;
+
+#ifdef DEBUG
+	printf("tilesource_build_done_idle: z = %d\n", build->z);
+#endif /*DEBUG*/
+
+	if (tilesource->build_z == build->z)
+		tilesource->build_z = -1;
+
+	/* Only swap the new pipeline in if the display settings haven't changed
+	 * since we started, and we've not built this level some other way.
+	 */
+	if (build->serial == tilesource->build_serial &&
+		!tilesource_has_z(tilesource, build->z)) {
+		if (build->error) {
+			/* Report the failure like a load error. We don't build
+			 * levels for failed tilesources, so this won't repeat.
+			 */
+			tilesource->load_error = TRUE;
+			VIPS_FREE(tilesource->load_message);
+			tilesource->load_message = g_steal_pointer(&build->error);
+			tilesource_changed(tilesource);
+		}
+		else {
+			tilesource_level_stash(tilesource);
+			tilesource->current_z = build->z;
+			tilesource->image_width = build->image_width;
+			tilesource->image_height = build->image_height;
+			tilesource_set_image_half(tilesource,
+				g_steal_pointer(&build->image),
+				g_steal_pointer(&build->mask));
+			tilesource_set_rgb(tilesource, &build->rgb);
+
+			/* Repaint, and request tiles from the new pipeline.
+			 */
+			tilesource_level_ready(tilesource);
+		}
+	}
+
+	VIPS_FREE(build->error);
+	VIPS_UNREF(build->image);
+	VIPS_UNREF(build->mask);
+	VIPS_UNREF(build->rgb.rgb);
+	VIPS_UNREF(build->tilesource);
+	tilesource_view_clear(&build->view);
+	g_free(build);
+
+	return FALSE;
+}
+
+/* This runs for the build threadpool. Opening a level can be slow (eg.
+ * openslide, or a remote TIFF), so we do it off the main thread.
+ */
+static void
+tilesource_build_worker(void *data, void *user_data)
+{
+	TilesourceBuild *build = (TilesourceBuild *) data;
+
+	build->image = tilesource_image(build->tilesource, &build->view,
+		&build->mask, &build->image_width, &build->image_height, build->z);
+	if (!build->image ||
+		tilesource_view_rgb(&build->view, build->image, &build->rgb)) {
+		VIPS_UNREF(build->image);
+		VIPS_UNREF(build->mask);
+		build->error = vips_error_buffer_copy();
+	}
+
+	g_idle_add(tilesource_build_done_idle, build);
+}
+
+/* Start building a pipeline for @z in the background, unless there's already
+ * a build on the way.
+ */
+static void
+tilesource_build_level(Tilesource *tilesource, int z)
+{
+	if (tilesource->build_z != -1 ||
+		tilesource->load_error)
+		return;
+
+#ifdef DEBUG
+	printf("tilesource_build_level: %d\n", z);
+#endif /*DEBUG*/
+
+	TilesourceBuild *build = g_new0(TilesourceBuild, 1);
+	build->tilesource = g_object_ref(tilesource);
+	tilesource_view_init(&build->view, tilesource);
+	build->z = z;
+	build->serial = tilesource->build_serial;
+
+	tilesource->build_z = z;
+
+	g_thread_pool_push(tilesource_build_pool, build, NULL);
+}
+
 #ifdef DEBUG
 static const char *
 tilesource_property_name(guint prop_id)
@@ -943,6 +1965,85 @@ tilesource_page_flip(void *user_data)
 	return FALSE;
 }
 
+/* The scale and offset have been still for a while, rebuild with them.
+ */
+static gboolean
+tilesource_linear_timeout(void *user_data)
+{
+	Tilesource *tilesource = TILESOURCE(user_data);
+
+#ifdef DEBUG
+	printf("tilesource_linear_timeout:\n");
+#endif /*DEBUG*/
+
+	tilesource->linear_timeout = 0;
+
+	tilesource_update_rgb(tilesource);
+	tilesource_tiles_changed(tilesource);
+
+	return FALSE;
+}
+
+/* TRUE if drawing the current uchar tiles with the new scale and offset is
+ * as good as recomputing them: the tiles were made from unsigned int pixels
+ * with no clipping, and the new scale doesn't stretch them, so the result
+ * is within a grey level of a recompute.
+ */
+static gboolean
+tilesource_linear_exact(Tilesource *tilesource)
+{
+	double scale;
+	double offset;
+
+	if (!tilesource->image ||
+		!vips_band_format_isuint(tilesource->image->BandFmt))
+		return FALSE;
+
+	/* Pixels 0 to rgb_max must have mapped inside 0 to rgb_max.
+	 */
+	double lo = tilesource->rgb_offset;
+	double hi = tilesource->rgb_max * tilesource->rgb_scale +
+		tilesource->rgb_offset;
+	if (VIPS_MIN(lo, hi) < 0 ||
+		VIPS_MAX(lo, hi) > tilesource->rgb_max)
+		return FALSE;
+
+	tilesource_get_linear(tilesource, &scale, &offset);
+
+	return fabs(scale) <= fabs(tilesource->rgb_scale);
+}
+
+/* Scale or offset have changed.
+ *
+ * Float tiles, and rgb_transfer, apply these at draw time and only need a
+ * redraw. If the
+ * transform commutes with the rest of the pipeline, we can redraw the
+ * current uchar tiles with a colour matrix while the user drags the slider,
+ * and only recompute once it's been still for a moment. The old tiles might
+ * have clipped, so we must recompute eventually, unless they are good
+ * enough already. Otherwise, recompute now.
+ */
+static void
+tilesource_linear_changed(Tilesource *tilesource)
+{
+	if (tilesource->rgb_float ||
+		tilesource->rgb_transfer)
+		tilesource_display_changed(tilesource);
+	else if (tilesource->rgb_linear) {
+		tilesource_display_changed(tilesource);
+
+		VIPS_FREEF(g_source_remove, tilesource->linear_timeout);
+		if (!tilesource_linear_exact(tilesource))
+			tilesource->linear_timeout = g_timeout_add(
+				TILESOURCE_LINEAR_DELAY,
+				tilesource_linear_timeout, tilesource);
+	}
+	else {
+		tilesource_update_rgb(tilesource);
+		tilesource_tiles_changed(tilesource);
+	}
+}
+
 static void
 tilesource_set_property(GObject *object,
 	guint prop_id, const GValue *value, GParamSpec *pspec)
@@ -991,8 +2092,7 @@ tilesource_set_property(GObject *object,
 			d <= 1000000 &&
 			tilesource->scale != d) {
 			tilesource->scale = d;
-			tilesource_update_rgb(tilesource);
-			tilesource_tiles_changed(tilesource);
+			tilesource_linear_changed(tilesource);
 		}
 		break;
 
@@ -1002,8 +2102,7 @@ tilesource_set_property(GObject *object,
 			d <= 1000000 &&
 			tilesource->offset != d) {
 			tilesource->offset = d;
-			tilesource_update_rgb(tilesource);
-			tilesource_tiles_changed(tilesource);
+			tilesource_linear_changed(tilesource);
 		}
 		break;
 
@@ -1041,9 +2140,15 @@ tilesource_set_property(GObject *object,
 		b = g_value_get_boolean(value);
 		if (tilesource->log != b) {
 			tilesource->log = b;
-			tilesource_update_rgb(tilesource);
-			tilesource_tiles_changed(tilesource);
-		}
+
+			// the painter might be doing log for us
+			if (tilesource->rgb_transfer)
+				tilesource_display_changed(tilesource);
+			else {
+				tilesource_update_rgb(tilesource);
+				tilesource_tiles_changed(tilesource);
+			}
+		}
 		break;
 
 	case PROP_ICC:
@@ -1165,6 +2270,383 @@ tilesource_init(Tilesource *tilesource)
 
 	tilesource->scale = 1.0;
 	tilesource->zoom = 1.0;
+	tilesource->float_tiles = tilesource_float_default;
+	tilesource->rgb_max = 255.0;
+	tilesource->rgb_scale = 1.0;
+	tilesource->build_z = -1;
+	g_mutex_init(&tilesource->pyramid_lock);
+}
+
+/* Detect a TIFF pyramid made of subifds following a roughly /2 shrink.
+ */
+static void
+tilesource_get_pyramid_subifd(Tilesource *tilesource)
+{
+	int i;
+
+#ifdef DEBUG
+	printf("tilesource_get_pyramid_subifd:\n");
+#endif /*DEBUG*/
+
+	for (i = 0; i < tilesource->n_subifds; i++) {
+		int expected_level_width;
+		int expected_level_height;
+
+		if (i >= MAX_LEVELS)
+			break;
+
+		g_autoptr(VipsImage) level = tilesource_open(tilesource, i);
+		if (!level)
+			// some OMEs have strange tile sizes for some levels, ignore them
+			break;
+		tilesource->level_width[i] = level->Xsize;
+		tilesource->level_height[i] = level->Ysize;
+
+		expected_level_width = tilesource->level_width[0] / (1 << i);
+		expected_level_height = tilesource->level_height[0] / (1 << i);
+
+		/* This won't be exact due to rounding etc.
+		 */
+		if (abs(level->Xsize - expected_level_width) > 5 ||
+			level->Xsize < 2 ||
+			abs(level->Ysize - expected_level_height) > 5 ||
+			level->Ysize < 2) {
+#ifdef DEBUG
+			printf("  bad subifd level %d\n", i);
+#endif /*DEBUG*/
+			return;
+		}
+	}
+
+	/* Tag as a subifd pyramid.
+	 */
+	tilesource->subifd_pyramid = TRUE;
+	tilesource->level_count = i;
+}
+
+/* A pyramid we are writing to the cache.
+ */
+typedef struct _TilesourceConvert {
+	Tilesource *tilesource;
+	VipsImage *image;
+	char *path;
+	gint64 cache_size;
+} TilesourceConvert;
+
+/* A key for a file which changes if the file is modified. mtime is only to
+ * the second, so we add the microseconds, plus ctime and the inode to catch
+ * files replaced by a rename. Attributes the platform lacks read as 0.
+ */
+static char *
+tilesource_file_key(const char *filename)
+{
+	g_autoptr(GFile) file = g_file_new_for_path(filename);
+	g_autoptr(GFileInfo) info = g_file_query_info(file,
+		G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+		G_FILE_ATTRIBUTE_TIME_CHANGED ","
+		G_FILE_ATTRIBUTE_UNIX_INODE,
+		G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if (!info)
+		return NULL;
+
+	return g_strdup_printf("%s:%" G_GINT64_FORMAT ":%" G_GUINT64_FORMAT
+		".%06u:%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT,
+		filename,
+		(gint64) g_file_info_get_size(info),
+		g_file_info_get_attribute_uint64(info,
+			G_FILE_ATTRIBUTE_TIME_MODIFIED),
+		g_file_info_get_attribute_uint32(info,
+			G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+		g_file_info_get_attribute_uint64(info,
+			G_FILE_ATTRIBUTE_TIME_CHANGED),
+		g_file_info_get_attribute_uint64(info,
+			G_FILE_ATTRIBUTE_UNIX_INODE));
+}
+
+/* Where we cache a pyramid for a file. The key changes if the file does,
+ * so we never show an out of date cache.
+ */
+static char *
+tilesource_cache_path(const char *filename)
+{
+	g_autofree char *key = tilesource_file_key(filename);
+	if (!key)
+		return NULL;
+
+	g_autofree char *hash =
+		g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+	g_autofree char *name = g_strdup_printf("%s.tif", hash);
+
+	return g_build_filename(g_get_user_cache_dir(),
+		PACKAGE, "pyramids", name, NULL);
+}
+
+/* TRUE for a single-page file with no pyramid from a format without random
+ * access, ie. baseline JPEG, PNG and strip TIFF, with more than @pixels
+ * pixels. These decode from the top.
+ */
+static gboolean
+tilesource_is_sequential(Tilesource *tilesource, gint64 pixels)
+{
+	return tilesource->filename &&
+		!tilesource->cache_filename &&
+		tilesource->type != TILESOURCE_TYPE_IMAGE &&
+		tilesource->level_count == 1 &&
+		tilesource->n_pages == 1 &&
+		(gint64) tilesource->level_width[0] * tilesource->level_height[0] >=
+			pixels &&
+		(vips_isprefix("jpeg", tilesource->loader) ||
+			vips_isprefix("png", tilesource->loader) ||
+			(vips_isprefix("tiff", tilesource->loader) &&
+				!tilesource->tiled));
+}
+
+/* Large sequential images re-decode from the top for every pan.
+ */
+static gboolean
+tilesource_cache_wanted(Tilesource *tilesource)
+{
+	return tilesource_pyramid_cache &&
+		tilesource_is_sequential(tilesource,
+			tilesource_pyramid_cache_pixels);
+}
+
+/* Switch the display pipeline over to a cached pyramid. @base stays as the
+ * original file.
+ */
+static int
+tilesource_set_cache(Tilesource *tilesource, const char *path)
+{
+	g_autoptr(VipsImage) plain = vips_image_new_from_file(path, NULL);
+	if (!plain)
+		return -1;
+
+#ifdef DEBUG
+	printf("tilesource_set_cache: %s\n", path);
+#endif /*DEBUG*/
+
+	VIPS_FREE(tilesource->cache_filename);
+	tilesource->cache_filename = g_strdup(path);
+	tilesource->n_subifds = vips_image_get_n_subifds(plain);
+	tilesource->subifd_pyramid = TRUE;
+	tilesource_get_pyramid_subifd(tilesource);
+
+	if (tilesource->level_count < 2) {
+		VIPS_FREE(tilesource->cache_filename);
+		tilesource->subifd_pyramid = FALSE;
+		tilesource->level_count = 1;
+		return -1;
+	}
+
+	/* Our generated pyramid is no longer needed.
+	 */
+	g_mutex_lock(&tilesource->pyramid_lock);
+	tilesource_free_pyramid(tilesource);
+	g_mutex_unlock(&tilesource->pyramid_lock);
+
+	return 0;
+}
+
+/* This runs in the main thread when a conversion is done.
+ */
+static gboolean
+tilesource_convert_done_idle(void *user_data)
+{
+	TilesourceConvert *convert = (TilesourceConvert *) user_data;
+	Tilesource *tilesource = convert->tilesource;
+
+	if (convert->path &&
+		!tilesource_set_cache(tilesource, convert->path)) {
+		tilesource_update_image(tilesource);
+		tilesource_changed(tilesource);
+	}
+
+	VIPS_FREE(convert->path);
+	VIPS_UNREF(convert->image);
+	VIPS_UNREF(convert->tilesource);
+	g_free(convert);
+
+	return FALSE;
+}
+
+static void
+tilesource_preeval(VipsImage *image,
+	VipsProgress *progress, Tilesource *tilesource)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_PREEVAL], 0, progress);
+}
+
+static void
+tilesource_eval(VipsImage *image,
+	VipsProgress *progress, Tilesource *tilesource)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_EVAL], 0, progress);
+}
+
+static void
+tilesource_posteval(VipsImage *image,
+	VipsProgress *progress, Tilesource *tilesource)
+{
+	g_signal_emit(tilesource, tilesource_signals[SIG_POSTEVAL], 0, progress);
+}
+
+/* A file in the pyramid cache dir.
+ */
+typedef struct _TilesourceCacheFile {
+	char *path;
+	gint64 size;
+	gint64 mtime;
+} TilesourceCacheFile;
+
+static int
+tilesource_cache_file_compare(const void *a, const void *b)
+{
+	const TilesourceCacheFile *fa = (const TilesourceCacheFile *) a;
+	const TilesourceCacheFile *fb = (const TilesourceCacheFile *) b;
+
+	return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime ? 1 : 0;
+}
+
+/* Remove the least recently used pyramids in @dir until we are under
+ * @size bytes. Pyramids are touched when they are opened, see
+ * tilesource_background_load(), so mtime is the time of last use. We always
+ * keep the newest.
+ */
+static void
+tilesource_cache_trim(const char *dir, gint64 size)
+{
+	GDir *gdir;
+	const char *name;
+
+	if (!(gdir = g_dir_open(dir, 0, NULL)))
+		return;
+
+	g_autoptr(GArray) files =
+		g_array_new(FALSE, FALSE, sizeof(TilesourceCacheFile));
+	gint64 total = 0;
+
+	while ((name = g_dir_read_name(gdir))) {
+		TilesourceCacheFile file;
+		GStatBuf buf;
+
+		if (!g_str_has_suffix(name, ".tif"))
+			continue;
+
+		file.path = g_build_filename(dir, name, NULL);
+		if (g_stat(file.path, &buf)) {
+			g_free(file.path);
+			continue;
+		}
+		file.size = buf.st_size;
+		file.mtime = buf.st_mtime;
+
+		g_array_append_val(files, file);
+		total += file.size;
+	}
+	g_dir_close(gdir);
+
+	g_array_sort(files, tilesource_cache_file_compare);
+
+	for (guint i = 0; i < files->len; i++) {
+		TilesourceCacheFile *file =
+			&g_array_index(files, TilesourceCacheFile, i);
+
+		if (total > size &&
+			i < files->len - 1) {
+#ifdef DEBUG
+			printf("tilesource_cache_trim: removing %s\n", file->path);
+#endif /*DEBUG*/
+
+			if (!g_unlink(file->path))
+				total -= file->size;
+		}
+
+		g_free(file->path);
+	}
+}
+
+/* This runs for the convert threadpool. Progress is signalled on @image, so
+ * it shows in the window as a load does. We write to a temp file and rename,
+ * so a partial pyramid is never picked up.
+ */
+static void
+tilesource_convert_worker(void *data, void *user_data)
+{
+	TilesourceConvert *convert = (TilesourceConvert *) data;
+	g_autofree char *dir = g_path_get_dirname(convert->path);
+	g_autofree char *part = g_strdup_printf("%s.part", convert->path);
+
+#ifdef DEBUG
+	printf("tilesource_convert_worker: writing %s\n", convert->path);
+#endif /*DEBUG*/
+
+	if (g_mkdir_with_parents(dir, 0700) ||
+		vips_tiffsave(convert->image, part,
+			"tile", TRUE,
+			"tile_width", TILE_SIZE,
+			"tile_height", TILE_SIZE,
+			"pyramid", TRUE,
+			"subifd", TRUE,
+			"bigtiff", TRUE,
+			"compression", VIPS_FOREIGN_TIFF_COMPRESSION_LZW,
+			NULL) ||
+		g_rename(part, convert->path)) {
+#ifdef DEBUG
+		printf("tilesource_convert_worker: %s\n", vips_error_buffer());
+#endif /*DEBUG*/
+		vips_error_clear();
+		g_unlink(part);
+		VIPS_FREE(convert->path);
+	}
+	else
+		tilesource_cache_trim(dir, convert->cache_size);
+
+	g_idle_add(tilesource_convert_done_idle, convert);
+}
+
+/* Start writing a cached pyramid in the background.
+ */
+static void
+tilesource_convert(Tilesource *tilesource, const char *path)
+{
+	VipsImage *image;
+
+	/* A copy, so the progress handlers don't stay on @base.
+	 */
+	if (vips_copy(tilesource->base, &image, NULL)) {
+		vips_error_clear();
+		return;
+	}
+
+	vips_image_set_progress(image, TRUE);
+	g_signal_connect_object(image, "preeval",
+		G_CALLBACK(tilesource_preeval), tilesource, 0);
+	g_signal_connect_object(image, "eval",
+		G_CALLBACK(tilesource_eval), tilesource, 0);
+	g_signal_connect_object(image, "posteval",
+		G_CALLBACK(tilesource_posteval), tilesource, 0);
+
+	TilesourceConvert *convert = g_new0(TilesourceConvert, 1);
+	convert->tilesource = g_object_ref(tilesource);
+	convert->image = image;
+	convert->path = g_strdup(path);
+	convert->cache_size = tilesource_pyramid_cache_size;
+
+	g_thread_pool_push(tilesource_convert_pool, convert, NULL);
+}
+
+/* Convert large images with no pyramid to a tiled pyramid in the user cache
+ * dir, for new tilesources.
+ */
+void
+tilesource_set_pyramid_cache(gboolean pyramid_cache, int megapixels,
+	int megabytes)
+{
+	tilesource_pyramid_cache = pyramid_cache;
+	tilesource_pyramid_cache_pixels = (gint64) megapixels * 1000 * 1000;
+	tilesource_pyramid_cache_size = (gint64) megabytes * 1024 * 1024;
 }
 
 static int
@@ -1198,6 +2680,14 @@ tilesource_background_load_done_idle(void *user_data)
 	printf("tilesource_background_load_done_cb: ... unreffing\n");
 #endif /*DEBUG*/
 
+	/* We never display a cancelled load, see tilesource_cancel_load().
+	 * Making the pipeline from base would start a full decode.
+	 */
+	if (g_atomic_int_get(&tilesource->load_cancel)) {
+		g_object_unref(tilesource);
+		return FALSE;
+	}
+
 	/* You can now fetch pixels from abse and rebuild image.
 	 */
 	g_object_set(tilesource,
@@ -1207,6 +2697,16 @@ tilesource_background_load_done_idle(void *user_data)
 	tilesource_update_image(tilesource);
 	tilesource_loaded(tilesource);
 
+	/* Start making a cached pyramid, if this image needs one.
+	 */
+	if (!tilesource->load_error &&
+		tilesource_cache_wanted(tilesource)) {
+		g_autofree char *path = tilesource_cache_path(tilesource->filename);
+
+		if (path)
+			tilesource_convert(tilesource, path);
+	}
+
 	/* Drop the ref that kept this tilesource alive during load, see
 	 * tilesource_background_load().
 	 */
@@ -1228,7 +2728,15 @@ tilesource_background_load_worker(void *data, void *user_data)
 
 	g_assert(tilesource->base);
 
-	if (tilesource_force_load(tilesource)) {
+	/* A load that was cancelled while it waited in the queue never starts.
+	 * One that has started runs to the end, but nothing will display it.
+	 */
+	if (g_atomic_int_get(&tilesource->load_cancel)) {
+		tilesource->load_error = TRUE;
+		tilesource->load_message = g_strdup(_("Load cancelled"));
+	}
+	else if (!tilesource->cache_filename &&
+		tilesource_force_load(tilesource)) {
 		tilesource->load_error = TRUE;
 		tilesource->load_message = vips_error_buffer_copy();
 	}
@@ -1240,12 +2748,335 @@ tilesource_background_load_worker(void *data, void *user_data)
 #endif /*DEBUG*/
 }
 
+/* Decode sequential images with more pixels than this ourselves, so we can
+ * display rows as they arrive.
+ */
+#define TILESOURCE_PREVIEW_PIXELS (16 * 1000 * 1000)
+
+/* If the decoded image is too large for memory, display a subsampled copy of
+ * no more than this many bytes while it loads.
+ */
+#define TILESOURCE_PREVIEW_SIZE (32 * 1024 * 1024)
+
+/* Repaint new rows at most this often, in seconds.
+ */
+#define TILESOURCE_PREVIEW_INTERVAL (0.2)
+
+/* A load we are doing ourselves, see tilesource_decode_start().
+ */
+typedef struct _TilesourceDecode {
+	Tilesource *tilesource;
+
+	/* The sequential read of the file, and the image we write it to. This
+	 * becomes @base when we're done.
+	 */
+	VipsImage *in;
+	VipsImage *decoded;
+
+	/* If @decoded is a temp file, we also copy every @shrink-th pixel to
+	 * this memory image for display.
+	 */
+	VipsImage *memory;
+	int shrink;
+
+	/* The rows we've asked to be painted, and when.
+	 */
+	int painted;
+	double last_time;
+
+	/* Set by the decode thread if the load fails. We copy it to the
+	 * tilesource on the main thread.
+	 */
+	char *error;
+} TilesourceDecode;
+
+/* A strip of newly decoded rows.
+ */
+typedef struct _TilesourceRows {
+	Tilesource *tilesource;
+	VipsRect area;
+} TilesourceRows;
+
+/* This runs in the main thread. No tile has been made from these rows yet,
+ * see tilesource_request_tile(), so there's nothing to invalidate, just
+ * repaint them.
+ */
+static gboolean
+tilesource_rows_idle(void *user_data)
+{
+	TilesourceRows *rows = (TilesourceRows *) user_data;
+
+	if (rows->tilesource->preview)
+		tilesource_rows_ready(rows->tilesource, &rows->area);
+
+	VIPS_UNREF(rows->tilesource);
+	g_free(rows);
+
+	return FALSE;
+}
+
+/* Write decoded rows, perhaps subsampling them into the memory image too.
+ * sink_disc calls this in order, top to bottom.
+ */
+static int
+tilesource_decode_write(VipsRegion *region, VipsRect *area, void *a)
+{
+	TilesourceDecode *decode = (TilesourceDecode *) a;
+	VipsImage *decoded = decode->decoded;
+	VipsImage *memory = decode->memory;
+
+	if (g_atomic_int_get(&decode->tilesource->load_cancel)) {
+		vips_error("tilesource", "%s", _("Load cancelled"));
+		return -1;
+	}
+
+	for (int y = area->top; y < VIPS_RECT_BOTTOM(area); y++) {
+		VipsPel *line = VIPS_REGION_ADDR(region, 0, y);
+
+		if (!memory)
+			memcpy(VIPS_IMAGE_ADDR(decoded, 0, y), line,
+				VIPS_IMAGE_SIZEOF_LINE(decoded));
+		else {
+			if (vips_image_write_line(decoded, y, line))
+				return -1;
+
+			if (y % decode->shrink == 0) {
+				size_t sizeof_pel = VIPS_IMAGE_SIZEOF_PEL(memory);
+				VipsPel *q = VIPS_IMAGE_ADDR(memory, 0, y / decode->shrink);
+
+				for (int x = 0; x < memory->Xsize; x++)
+					memcpy(q + x * sizeof_pel,
+						line + x * decode->shrink * sizeof_pel,
+						sizeof_pel);
+			}
+		}
+	}
+
+	g_atomic_int_set(&decode->tilesource->preview_rows,
+		VIPS_RECT_BOTTOM(area));
+
+	return 0;
+}
+
+/* Progress on the decode, from the decode thread. Throttle, and repaint the
+ * rows that have arrived since last time.
+ */
+static void
+tilesource_decode_eval(VipsImage *image,
+	VipsProgress *progress, TilesourceDecode *decode)
+{
+	double time_now = g_timer_elapsed(progress->start, NULL);
+	int rows = g_atomic_int_get(&decode->tilesource->preview_rows);
+
+	if (time_now - decode->last_time < TILESOURCE_PREVIEW_INTERVAL ||
+		rows <= decode->painted)
+		return;
+	decode->last_time = time_now;
+
+	TilesourceRows *update = g_new0(TilesourceRows, 1);
+	update->tilesource = g_object_ref(decode->tilesource);
+	update->area.left = 0;
+	update->area.top = decode->painted;
+	update->area.width = image->Xsize;
+	update->area.height = rows - decode->painted;
+	decode->painted = rows;
+
+	g_idle_add(tilesource_rows_idle, update);
+}
+
+/* This runs in the main thread when the decode is done. Display from the
+ * decoded pixels, then finish the load as usual.
+ */
+static gboolean
+tilesource_decode_done_idle(void *user_data)
+{
+	TilesourceDecode *decode = (TilesourceDecode *) user_data;
+	Tilesource *tilesource = decode->tilesource;
+
+	if (decode->error) {
+		tilesource->load_error = TRUE;
+		VIPS_FREE(tilesource->load_message);
+		tilesource->load_message = g_steal_pointer(&decode->error);
+	}
+
+	if (!tilesource->load_error &&
+		vips_image_pio_input(decode->decoded)) {
+		tilesource->load_error = TRUE;
+		tilesource->load_message = vips_error_buffer_copy();
+	}
+
+	if (!tilesource->load_error) {
+		VIPS_UNREF(tilesource->base);
+		tilesource->base = g_object_ref(decode->decoded);
+		tilesource->decoded = TRUE;
+	}
+
+	g_mutex_lock(&tilesource->pyramid_lock);
+	VIPS_UNREF(tilesource->preview);
+	g_mutex_unlock(&tilesource->pyramid_lock);
+
+	/* @in can live on in the libvips operation cache.
+	 */
+	g_signal_handlers_disconnect_by_data(decode->in, decode);
+	g_signal_handlers_disconnect_by_data(decode->in, tilesource);
+
+	tilesource_background_load_done_idle(tilesource);
+
+	/* If we displayed a subsampled copy, fetch everything again. Otherwise
+	 * we displayed @decoded itself and tiles are already correct.
+	 */
+	if (decode->memory)
+		tilesource_tiles_changed(tilesource);
+
+	VIPS_UNREF(decode->memory);
+	VIPS_UNREF(decode->decoded);
+	VIPS_UNREF(decode->in);
+	VIPS_UNREF(decode->tilesource);
+	g_free(decode);
+
+	return FALSE;
+}
+
+/* This runs for the decode threadpool.
+ */
+static void
+tilesource_decode_worker(void *data, void *user_data)
+{
+	TilesourceDecode *decode = (TilesourceDecode *) data;
+
+#ifdef DEBUG
+	printf("tilesource_decode_worker: starting ...\n");
+#endif /*DEBUG*/
+
+	if (vips_sink_disc(decode->in, tilesource_decode_write, decode))
+		decode->error = vips_error_buffer_copy();
+
+	g_idle_add(tilesource_decode_done_idle, decode);
+
+#ifdef DEBUG
+	printf("tilesource_decode_worker: ... done\n");
+#endif /*DEBUG*/
+}
+
+/* libvips can't show us the pixels of a load in progress, so for large
+ * images which decode from the top we do the load ourselves, with a
+ * sequential read of the file into an image we can see. This is in memory
+ * or, like libvips, in a temp file if it's larger than the disc threshold.
+ *
+ * Until the load is done we display @preview, the decoded image itself if
+ * it's in memory, or a subsampled copy if not, and only request tiles from
+ * the rows that have arrived.
+ */
+static int
+tilesource_decode_start(Tilesource *tilesource)
+{
+	int width = tilesource->level_width[0];
+	int height = tilesource->level_height[0];
+
+	g_autoptr(VipsImage) in = NULL;
+	g_autoptr(VipsImage) decoded = NULL;
+	g_autoptr(VipsImage) memory = NULL;
+	g_autoptr(VipsImage) preview = NULL;
+	VipsImage *x;
+	int shrink;
+
+#ifdef DEBUG
+	printf("tilesource_decode_start: %s\n", tilesource->filename);
+#endif /*DEBUG*/
+
+	if (!(in = vips_image_new_from_file(tilesource->filename,
+			  "access", VIPS_ACCESS_SEQUENTIAL,
+			  "revalidate", TRUE,
+			  NULL)))
+		return -1;
+	if (in->Xsize != width ||
+		in->Ysize != height)
+		return -1;
+
+	if (VIPS_IMAGE_SIZEOF_IMAGE(in) <= vips_get_disc_threshold()) {
+		decoded = vips_image_new_memory();
+		if (vips_image_pipelinev(decoded,
+				VIPS_DEMAND_STYLE_THINSTRIP, in, NULL) ||
+			vips_image_write_prepare(decoded))
+			return -1;
+		vips_image_remove(decoded, VIPS_META_SEQUENTIAL);
+		memset(VIPS_IMAGE_ADDR(decoded, 0, 0), 0,
+			VIPS_IMAGE_SIZEOF_IMAGE(decoded));
+
+		shrink = 1;
+		preview = g_object_ref(decoded);
+	}
+	else {
+		if (!(decoded = vips_image_new_temp_file("%s.v")) ||
+			vips_image_pipelinev(decoded,
+				VIPS_DEMAND_STYLE_THINSTRIP, in, NULL))
+			return -1;
+		vips_image_remove(decoded, VIPS_META_SEQUENTIAL);
+
+		for (shrink = 2;
+			 VIPS_IMAGE_SIZEOF_IMAGE(in) / ((guint64) shrink * shrink) >
+			 TILESOURCE_PREVIEW_SIZE;
+			 shrink++)
+			;
+
+		memory = vips_image_new_memory();
+		vips_image_init_fields(memory,
+			VIPS_ROUND_UP(width, shrink) / shrink,
+			VIPS_ROUND_UP(height, shrink) / shrink,
+			in->Bands, in->BandFmt,
+			in->Coding, in->Type, in->Xres, in->Yres);
+		if (vips_image_write_prepare(memory))
+			return -1;
+		memset(VIPS_IMAGE_ADDR(memory, 0, 0), 0,
+			VIPS_IMAGE_SIZEOF_IMAGE(memory));
+
+		/* Zoom back up to level0 size.
+		 */
+		if (vips_zoom(memory, &x, shrink, shrink, NULL))
+			return -1;
+		preview = x;
+		if (vips_crop(preview, &x, 0, 0, width, height, NULL))
+			return -1;
+		VIPS_UNREF(preview);
+		preview = x;
+	}
+
+	TilesourceDecode *decode = g_new0(TilesourceDecode, 1);
+	decode->tilesource = g_object_ref(tilesource);
+	decode->in = g_object_ref(in);
+	decode->decoded = g_object_ref(decoded);
+	decode->memory = memory ? g_object_ref(memory) : NULL;
+	decode->shrink = shrink;
+
+	/* This is the load, so it drives the progress display.
+	 */
+	vips_image_set_progress(in, TRUE);
+	g_signal_connect_object(in, "preeval",
+		G_CALLBACK(tilesource_preeval), tilesource, 0);
+	g_signal_connect_object(in, "eval",
+		G_CALLBACK(tilesource_eval), tilesource, 0);
+	g_signal_connect_object(in, "posteval",
+		G_CALLBACK(tilesource_posteval), tilesource, 0);
+	g_signal_connect(in, "eval",
+		G_CALLBACK(tilesource_decode_eval), decode);
+
+	g_mutex_lock(&tilesource->pyramid_lock);
+	tilesource->preview = g_steal_pointer(&preview);
+	g_mutex_unlock(&tilesource->pyramid_lock);
+	g_atomic_int_set(&tilesource->preview_rows, 0);
+
+	g_thread_pool_push(tilesource_decode_pool, decode, NULL);
+
+	return 0;
+}
+
 static void
 tilesource_class_init(TilesourceClass *class)
 {
 	GObjectClass *gobject_class = G_OBJECT_CLASS(class);
 
 	gobject_class->dispose = tilesource_dispose;
+	gobject_class->finalize = tilesource_finalize;
 	gobject_class->set_property = tilesource_set_property;
 	gobject_class->get_property = tilesource_get_property;
 
@@ -1380,26 +3211,79 @@ tilesource_class_init(TilesourceClass *class)
 		G_TYPE_POINTER,
 		G_TYPE_INT);
 
-	tilesource_signals[SIG_PAGE_CHANGED] = g_signal_new("page-changed",
+	tilesource_signals[SIG_COLLECT_DONE] = g_signal_new("collect-done",
+		G_TYPE_FROM_CLASS(class),
+		G_SIGNAL_RUN_LAST,
+		G_STRUCT_OFFSET(TilesourceClass, collect_done),
+		NULL, NULL,
+		g_cclosure_marshal_VOID__VOID,
+		G_TYPE_NONE, 0);
+
+	tilesource_signals[SIG_DISPLAY_CHANGED] = g_signal_new("display-changed",
+		G_TYPE_FROM_CLASS(class),
+		G_SIGNAL_RUN_LAST,
+		G_STRUCT_OFFSET(TilesourceClass, display_changed),
+		NULL, NULL,
+		g_cclosure_marshal_VOID__VOID,
+		G_TYPE_NONE, 0);
+
+	tilesource_signals[SIG_PAGE_CHANGED] = g_signal_new("page-changed",
+		G_TYPE_FROM_CLASS(class),
+		G_SIGNAL_RUN_LAST,
+		G_STRUCT_OFFSET(TilesourceClass, page_changed),
+		NULL, NULL,
+		g_cclosure_marshal_VOID__VOID,
+		G_TYPE_NONE, 0);
+
+	tilesource_signals[SIG_LOADED] = g_signal_new("loaded",
+		G_TYPE_FROM_CLASS(class),
+		G_SIGNAL_RUN_LAST,
+		G_STRUCT_OFFSET(TilesourceClass, loaded),
+		NULL, NULL,
+		g_cclosure_marshal_VOID__VOID,
+		G_TYPE_NONE, 0);
+
+	tilesource_signals[SIG_LEVEL_READY] = g_signal_new("level-ready",
 		G_TYPE_FROM_CLASS(class),
 		G_SIGNAL_RUN_LAST,
-		G_STRUCT_OFFSET(TilesourceClass, page_changed),
+		G_STRUCT_OFFSET(TilesourceClass, level_ready),
 		NULL, NULL,
 		g_cclosure_marshal_VOID__VOID,
 		G_TYPE_NONE, 0);
 
-	tilesource_signals[SIG_LOADED] = g_signal_new("loaded",
+	tilesource_signals[SIG_ROWS_READY] = g_signal_new("rows-ready",
 		G_TYPE_FROM_CLASS(class),
 		G_SIGNAL_RUN_LAST,
-		G_STRUCT_OFFSET(TilesourceClass, loaded),
+		G_STRUCT_OFFSET(TilesourceClass, rows_ready),
 		NULL, NULL,
-		g_cclosure_marshal_VOID__VOID,
-		G_TYPE_NONE, 0);
+		g_cclosure_marshal_VOID__POINTER,
+		G_TYPE_NONE, 1,
+		G_TYPE_POINTER);
 
 	g_assert(!tilesource_background_load_pool);
 	tilesource_background_load_pool = g_thread_pool_new(
 		tilesource_background_load_worker,
 		NULL, -1, FALSE, NULL);
+
+	g_assert(!tilesource_pack_pool);
+	tilesource_pack_pool = g_thread_pool_new(
+		tilesource_pack_worker,
+		NULL, vips_concurrency_get(), FALSE, NULL);
+
+	g_assert(!tilesource_convert_pool);
+	tilesource_convert_pool = g_thread_pool_new(
+		tilesource_convert_worker,
+		NULL, 1, FALSE, NULL);
+
+	g_assert(!tilesource_build_pool);
+	tilesource_build_pool = g_thread_pool_new(
+		tilesource_build_worker,
+		NULL, -1, FALSE, NULL);
+
+	g_assert(!tilesource_decode_pool);
+	tilesource_decode_pool = g_thread_pool_new(
+		tilesource_decode_worker,
+		NULL, -1, FALSE, NULL);
 }
 
 #ifdef DEBUG
@@ -1528,53 +3412,6 @@ tilesource_new_from_image(VipsImage *image)
 	return g_steal_pointer(&tilesource);
 }
 
-/* Detect a TIFF pyramid made of subifds following a roughly /2 shrink.
- */
-static void
-tilesource_get_pyramid_subifd(Tilesource *tilesource)
-{
-	int i;
-
-#ifdef DEBUG
-	printf("tilesource_get_pyramid_subifd:\n");
-#endif /*DEBUG*/
-
-	for (i = 0; i < tilesource->n_subifds; i++) {
-		int expected_level_width;
-		int expected_level_height;
-
-		if (i >= MAX_LEVELS)
-			break;
-
-		g_autoptr(VipsImage) level = tilesource_open(tilesource, i);
-		if (!level)
-			// some OMEs have strange tile sizes for some levels, ignore them
-			break;
-		tilesource->level_width[i] = level->Xsize;
-		tilesource->level_height[i] = level->Ysize;
-
-		expected_level_width = tilesource->level_width[0] / (1 << i);
-		expected_level_height = tilesource->level_height[0] / (1 << i);
-
-		/* This won't be exact due to rounding etc.
-		 */
-		if (abs(level->Xsize - expected_level_width) > 5 ||
-			level->Xsize < 2 ||
-			abs(level->Ysize - expected_level_height) > 5 ||
-			level->Ysize < 2) {
-#ifdef DEBUG
-			printf("  bad subifd level %d\n", i);
-#endif /*DEBUG*/
-			return;
-		}
-	}
-
-	/* Tag as a subifd pyramid.
-	 */
-	tilesource->subifd_pyramid = TRUE;
-	tilesource->level_count = i;
-}
-
 /* Detect a pyramid made of pages following a roughly /2 shrink. Can be eg.
  * jp2k or TIFF.
  */
@@ -1634,27 +3471,6 @@ tilesource_get_pyramid_page(Tilesource *tilesource)
 	tilesource->level_count = i;
 }
 
-static void
-tilesource_preeval(VipsImage *image,
-	VipsProgress *progress, Tilesource *tilesource)
-{
-	g_signal_emit(tilesource, tilesource_signals[SIG_PREEVAL], 0, progress);
-}
-
-static void
-tilesource_eval(VipsImage *image,
-	VipsProgress *progress, Tilesource *tilesource)
-{
-	g_signal_emit(tilesource, tilesource_signals[SIG_EVAL], 0, progress);
-}
-
-static void
-tilesource_posteval(VipsImage *image,
-	VipsProgress *progress, Tilesource *tilesource)
-{
-	g_signal_emit(tilesource, tilesource_signals[SIG_POSTEVAL], 0, progress);
-}
-
 static void
 tilesource_attach_progress(Tilesource *tilesource)
 {
@@ -1687,21 +3503,93 @@ get_int(VipsImage *image, const char *field, int default_value)
 	return default_value;
 }
 
-Tilesource *
-tilesource_new_from_file(const char *filename)
+/* Fetch an unsigned int of @size bytes from a TIFF header.
+ */
+static guint64
+tilesource_tiff_get(const guchar *p, int size, gboolean big_endian)
 {
-	g_autoptr(Tilesource) tilesource = g_object_new(TILESOURCE_TYPE, NULL);
+	guint64 value = 0;
 
-	const char *loader;
+	for (int i = 0; i < size; i++)
+		value |= (guint64) p[big_endian ? i : size - 1 - i] <<
+			(8 * (size - 1 - i));
 
-#ifdef DEBUG
-	printf("tilesource_new_from_file: %s\n", filename);
-#endif /*DEBUG*/
+	return value;
+}
 
-	tilesource->filename = g_strdup(filename);
+/* TRUE if the first IFD of a TIFF has a TileWidth tag. libvips doesn't
+ * tell us, and strip TIFFs have no random access, so we need to know.
+ */
+static gboolean
+tilesource_tiff_is_tiled(const char *filename)
+{
+	g_autoptr(GFile) file = g_file_new_for_path(filename);
+	g_autoptr(GFileInputStream) stream = g_file_read(file, NULL, NULL);
+	if (!stream)
+		return FALSE;
+
+	guchar header[16];
+	gsize n;
+	if (!g_input_stream_read_all(G_INPUT_STREAM(stream),
+			header, sizeof(header), &n, NULL, NULL) ||
+		n < 8)
+		return FALSE;
+
+	gboolean big_endian = header[0] == 'M';
+	int version = tilesource_tiff_get(header + 2, 2, big_endian);
+
+	/* Classic TIFF has 2-byte entry counts and 12-byte entries, BigTIFF
+	 * has 8-byte counts and 20-byte entries.
+	 */
+	gboolean bigtiff = version == 43;
+	int count_size = bigtiff ? 8 : 2;
+	int entry_size = bigtiff ? 20 : 12;
+	guint64 offset = bigtiff ?
+		tilesource_tiff_get(header + 8, 8, big_endian) :
+		tilesource_tiff_get(header + 4, 4, big_endian);
+	if ((bigtiff && n < 16) ||
+		!g_seekable_seek(G_SEEKABLE(stream), offset, G_SEEK_SET, NULL, NULL))
+		return FALSE;
+
+	guchar count[8];
+	if (!g_input_stream_read_all(G_INPUT_STREAM(stream),
+			count, count_size, &n, NULL, NULL) ||
+		n < count_size)
+		return FALSE;
+	guint64 n_entries = tilesource_tiff_get(count, count_size, big_endian);
+
+	/* Tags are sorted, so we can stop at the first one past TileWidth.
+	 */
+	for (guint64 i = 0; i < n_entries; i++) {
+		guchar entry[20];
+
+		if (!g_input_stream_read_all(G_INPUT_STREAM(stream),
+				entry, entry_size, &n, NULL, NULL) ||
+			n < entry_size)
+			return FALSE;
+
+		int tag = tilesource_tiff_get(entry, 2, big_endian);
+		if (tag == 322)
+			return TRUE;
+		if (tag > 322)
+			break;
+	}
 
-	if (!(loader = vips_foreign_find_load(filename)))
-		return NULL;
+	return FALSE;
+}
+
+/* Sniff the file structure: loader, pages, pyramid levels, and the type of
+ * image. The toilet-roll open can be the base too, so return it, if we can.
+ */
+static int
+tilesource_sniff(Tilesource *tilesource, VipsImage **base_out)
+{
+	const char *loader;
+
+	*base_out = NULL;
+
+	if (!(loader = vips_foreign_find_load(tilesource->filename)))
+		return -1;
 
 	/* vips_foreign_find_load() gives us eg.
 	 * "VipsForeignLoadNsgifFile", but we need "gifload", the
@@ -1709,11 +3597,15 @@ tilesource_new_from_file(const char *filename)
 	 */
 	tilesource->loader = vips_nickname_find(g_type_from_name(loader));
 
+	if (vips_isprefix("tiff", tilesource->loader))
+		tilesource->tiled = tilesource_tiff_is_tiled(tilesource->filename);
+
 	/* A very plain open to fetch image metadata.
 	 */
-	g_autoptr(VipsImage) plain = vips_image_new_from_file(filename, NULL);
+	g_autoptr(VipsImage) plain =
+		vips_image_new_from_file(tilesource->filename, NULL);
 	if (!plain)
-		return NULL;
+		return -1;
 
 	tilesource->n_subifds = vips_image_get_n_subifds(plain);
 	tilesource->n_pages = vips_image_get_n_pages(plain);
@@ -1777,9 +3669,10 @@ tilesource_new_from_file(const char *filename)
 
 		/* Apply the zoom and build the pyramid.
 		 */
-		g_autoptr(VipsImage) x = vips_image_new_from_file(filename,
-			"scale", tilesource->zoom,
-			NULL);
+		g_autoptr(VipsImage) x =
+			vips_image_new_from_file(tilesource->filename,
+				"scale", tilesource->zoom,
+				NULL);
 
 		/* Fake the pyramid geometry. No sense going smaller than
 		 * a tile.
@@ -1800,7 +3693,7 @@ tilesource_new_from_file(const char *filename)
 	 * page_size are sane too.
 	 */
 #ifdef DEBUG
-	printf("tilesource_new_from_file: test toilet-roll mode\n");
+	printf("tilesource_sniff: test toilet-roll mode\n");
 #endif /*DEBUG*/
 
 	/* Block error messages from eg. page-pyramidal TIFFs where pages
@@ -1808,7 +3701,7 @@ tilesource_new_from_file(const char *filename)
 	 */
 	tilesource->type = TILESOURCE_TYPE_TOILET_ROLL;
 	vips_error_freeze();
-	g_autoptr(VipsImage) x = tilesource_open(tilesource, 0);
+	VipsImage *x = tilesource_open(tilesource, 0);
 	vips_error_thaw();
 	if (x) {
 		/* Toilet-roll mode worked. We can update n_pages.
@@ -1820,7 +3713,7 @@ tilesource_new_from_file(const char *filename)
 		}
 		else {
 #ifdef DEBUG
-			printf("tilesource_new_from_file: bad page layout\n");
+			printf("tilesource_sniff: bad page layout\n");
 #endif /*DEBUG*/
 
 			tilesource->n_pages = 1;
@@ -1846,9 +3739,11 @@ tilesource_new_from_file(const char *filename)
 			tilesource->subifd_pyramid = FALSE;
 	}
 
-	/* If that failed, try to read as a page pyramid.
+	/* If that failed, try to read as a page pyramid. Pages all the same
+	 * size can't be a pyramid, so don't open them all to check.
 	 */
-	if (!tilesource->level_count) {
+	if (!tilesource->level_count &&
+		!tilesource->pages_same_size) {
 		tilesource->page_pyramid = TRUE;
 		tilesource_get_pyramid_page(tilesource);
 		if (!tilesource->level_count)
@@ -1866,10 +3761,151 @@ tilesource_new_from_file(const char *filename)
 			tilesource->type = TILESOURCE_TYPE_MULTIPAGE;
 	}
 
+	/* A toilet-roll open is also our base.
+	 */
+	if (x &&
+		tilesource->type == TILESOURCE_TYPE_TOILET_ROLL)
+		*base_out = x;
+	else
+		VIPS_UNREF(x);
+
+	return 0;
+}
+
+/* The result of a sniff, cached so reload and reopen can skip it.
+ */
+typedef struct _TilesourceProbe {
+	const char *loader;
+	TilesourceType type;
+	int n_pages;
+	int page_height;
+	int n_subifds;
+	gboolean subifd_pyramid;
+	gboolean page_pyramid;
+	gboolean pages_same_size;
+	gboolean all_mono;
+	gboolean tiled;
+	double zoom;
+	int level_count;
+	int level_width[MAX_LEVELS];
+	int level_height[MAX_LEVELS];
+} TilesourceProbe;
+
+/* Keep probes for up to this many files.
+ */
+#define TILESOURCE_PROBE_MAX (100)
+
+/* Probes, indexed by tilesource_file_key().
+ */
+G_LOCK_DEFINE_STATIC(tilesource_probe);
+static GHashTable *tilesource_probe_table = NULL;
+
+static void
+tilesource_probe_add(Tilesource *tilesource, const char *key)
+{
+	TilesourceProbe *probe = g_new(TilesourceProbe, 1);
+
+	probe->loader = tilesource->loader;
+	probe->type = tilesource->type;
+	probe->n_pages = tilesource->n_pages;
+	probe->page_height = tilesource->page_height;
+	probe->n_subifds = tilesource->n_subifds;
+	probe->subifd_pyramid = tilesource->subifd_pyramid;
+	probe->page_pyramid = tilesource->page_pyramid;
+	probe->pages_same_size = tilesource->pages_same_size;
+	probe->all_mono = tilesource->all_mono;
+	probe->tiled = tilesource->tiled;
+	probe->zoom = tilesource->zoom;
+	probe->level_count = tilesource->level_count;
+	memcpy(probe->level_width, tilesource->level_width,
+		sizeof(probe->level_width));
+	memcpy(probe->level_height, tilesource->level_height,
+		sizeof(probe->level_height));
+
+	G_LOCK(tilesource_probe);
+
+	if (!tilesource_probe_table)
+		tilesource_probe_table = g_hash_table_new_full(g_str_hash,
+			g_str_equal, g_free, g_free);
+
+	/* Crude, but probes are cheap to remake.
+	 */
+	if (g_hash_table_size(tilesource_probe_table) >= TILESOURCE_PROBE_MAX)
+		g_hash_table_remove_all(tilesource_probe_table);
+
+	g_hash_table_replace(tilesource_probe_table, g_strdup(key), probe);
+
+	G_UNLOCK(tilesource_probe);
+}
+
+static gboolean
+tilesource_probe_lookup(Tilesource *tilesource, const char *key)
+{
+	TilesourceProbe *probe;
+
+	G_LOCK(tilesource_probe);
+
+	if (tilesource_probe_table &&
+		(probe = g_hash_table_lookup(tilesource_probe_table, key))) {
+		tilesource->loader = probe->loader;
+		tilesource->type = probe->type;
+		tilesource->n_pages = probe->n_pages;
+		tilesource->page_height = probe->page_height;
+		tilesource->n_subifds = probe->n_subifds;
+		tilesource->subifd_pyramid = probe->subifd_pyramid;
+		tilesource->page_pyramid = probe->page_pyramid;
+		tilesource->pages_same_size = probe->pages_same_size;
+		tilesource->all_mono = probe->all_mono;
+		tilesource->tiled = probe->tiled;
+		tilesource->zoom = probe->zoom;
+		tilesource->level_count = probe->level_count;
+		memcpy(tilesource->level_width, probe->level_width,
+			sizeof(probe->level_width));
+		memcpy(tilesource->level_height, probe->level_height,
+			sizeof(probe->level_height));
+	}
+	else
+		probe = NULL;
+
+	G_UNLOCK(tilesource_probe);
+
+	return probe != NULL;
+}
+
+/* Make a tilesource from a file. If @cancellable is set, we give up early
+ * between the slow steps and return NULL with no error set.
+ */
+static Tilesource *
+tilesource_new_from_file_cancellable(const char *filename,
+	GCancellable *cancellable)
+{
+	g_autoptr(Tilesource) tilesource = g_object_new(TILESOURCE_TYPE, NULL);
+
+#ifdef DEBUG
+	printf("tilesource_new_from_file: %s\n", filename);
+#endif /*DEBUG*/
+
+	tilesource->filename = g_strdup(filename);
+
+	/* Sniff, unless we've seen this file before.
+	 */
+	g_autofree char *key = tilesource_file_key(filename);
+	gboolean probed = key &&
+		tilesource_probe_lookup(tilesource, key);
+	g_autoptr(VipsImage) base = NULL;
+	if (!probed &&
+		tilesource_sniff(tilesource, &base))
+		return NULL;
+
+	/* The user may have moved on while we sniffed.
+	 */
+	if (g_cancellable_is_cancelled(cancellable))
+		return NULL;
+
 	/* And now we can reopen in the correct mode.
 	 */
-	g_autoptr(VipsImage) base = tilesource_open(tilesource, 0);
-	if (!base)
+	if (!base &&
+		!(base = tilesource_open(tilesource, 0)))
 		return NULL;
 	if (tilesource_set_base(tilesource, base))
 		return NULL;
@@ -1889,6 +3925,10 @@ tilesource_new_from_file(const char *filename)
 		tilesource->page_height = tilesource->level_height[0];
 	}
 
+	if (key &&
+		!probed)
+		tilesource_probe_add(tilesource, key);
+
 	tilesource_default_mode(tilesource);
 
 	tilesource_attach_progress(tilesource);
@@ -1901,6 +3941,69 @@ tilesource_new_from_file(const char *filename)
 	return g_steal_pointer(&tilesource);
 }
 
+Tilesource *
+tilesource_new_from_file(const char *filename)
+{
+	return tilesource_new_from_file_cancellable(filename, NULL);
+}
+
+/* This runs in a GTask worker. Sniffing can be slow, eg. large PDFs, MRXS,
+ * OME-TIFF with thousands of IFDs.
+ */
+static void
+tilesource_new_from_file_thread(GTask *task,
+	gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	const char *filename = (const char *) task_data;
+
+	Tilesource *tilesource;
+
+	if (g_task_return_error_if_cancelled(task))
+		return;
+
+	if (!(tilesource =
+			tilesource_new_from_file_cancellable(filename, cancellable))) {
+		if (g_task_return_error_if_cancelled(task))
+			return;
+
+		g_autofree char *message = vips_error_buffer_copy();
+
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+			"%s", message);
+		return;
+	}
+
+	/* The user might have moved on while we were sniffing.
+	 */
+	if (g_task_return_error_if_cancelled(task)) {
+		g_object_unref(tilesource);
+		return;
+	}
+
+	g_task_return_pointer(task, tilesource, g_object_unref);
+}
+
+/* Make a tilesource in the background, so the UI never blocks on open.
+ * Call tilesource_new_from_file_finish() from @callback to get the result.
+ */
+void
+tilesource_new_from_file_async(const char *filename,
+	GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	g_autoptr(GTask) task = g_task_new(NULL, cancellable, callback, user_data);
+	g_task_set_source_tag(task, tilesource_new_from_file_async);
+	g_task_set_task_data(task, g_strdup(filename), g_free);
+	g_task_run_in_thread(task, tilesource_new_from_file_thread);
+}
+
+Tilesource *
+tilesource_new_from_file_finish(GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
 /* Call this some time after tilesource_new_from_file() or
  * tilesource_new_from_file(), and once all callbacks have been
  * attached, to trigger a bg load.
@@ -1914,10 +4017,53 @@ tilesource_background_load(Tilesource *tilesource)
 	 */
 	g_object_ref(tilesource);
 
+	/* If we've cached a pyramid for this file, display from that and skip
+	 * the full decode.
+	 */
+	if (tilesource_cache_wanted(tilesource)) {
+		g_autofree char *path = tilesource_cache_path(tilesource->filename);
+
+		if (path &&
+			g_file_test(path, G_FILE_TEST_EXISTS)) {
+			/* Mark as recently used, see tilesource_cache_trim().
+			 */
+			g_utime(path, NULL);
+			tilesource_set_cache(tilesource, path);
+		}
+	}
+
+	/* Otherwise, we load large images which decode from the top ourselves,
+	 * and show rows as they arrive.
+	 */
+	if (!tilesource->loaded &&
+		tilesource_is_sequential(tilesource, TILESOURCE_PREVIEW_PIXELS)) {
+		if (!tilesource_decode_start(tilesource)) {
+			tilesource_update_image(tilesource);
+			tilesource_changed(tilesource);
+			return;
+		}
+
+#ifdef DEBUG
+		printf("tilesource_background_load: no decode, %s\n",
+			vips_error_buffer());
+#endif /*DEBUG*/
+		vips_error_clear();
+	}
+
 	g_thread_pool_push(tilesource_background_load_pool,
 		tilesource, NULL);
 }
 
+/* Stop any background load or decode, eg. when the user moves to another
+ * image. The load finishes with an error, so the tilesource should be
+ * dropped.
+ */
+void
+tilesource_cancel_load(Tilesource *tilesource)
+{
+	g_atomic_int_set(&tilesource->load_cancel, TRUE);
+}
+
 /* Request a tile from the pipeline. The tile might be already there (in
  * cache), and we are all done, or it might need to be computed and collected
  * later.
@@ -1930,13 +4076,29 @@ tilesource_request_tile(Tilesource *tilesource, Tile *tile)
 		tile->region->valid.left, tile->region->valid.top);
 #endif /*DEBUG_VERBOSE*/
 
-	/* Change z if necessary.
+	/* While we show a preview, only request tiles whose rows have all
+	 * arrived, so no cache ever holds missing rows. The others are
+	 * requested again on the next "rows-ready".
 	 */
-	if (tilesource->current_z != tile->z ||
-		!tilesource->image) {
-		tilesource->current_z = tile->z;
-		tilesource_update_image(tilesource);
+	if (tilesource->preview &&
+		VIPS_MIN(VIPS_RECT_BOTTOM(&tile->bounds0),
+			tilesource->level_height[0]) >
+			g_atomic_int_get(&tilesource->preview_rows))
+		return 0;
+
+	/* Change z if necessary. If we have nothing for this level, build it in
+	 * the background and keep painting what we have. The tile will be
+	 * requested again when the new pipeline is ready.
+	 */
+	if (tilesource->image &&
+		!tilesource->synchronous &&
+		!tilesource_has_z(tilesource, tile->z)) {
+		tilesource_build_level(tilesource, tile->z);
+		return 0;
 	}
+	if (tilesource_set_z(tilesource, tile->z) ||
+		!tilesource->image)
+		return -1;
 
 	/* Clip the tile against the size of this level.
 	 */
@@ -1955,18 +4117,15 @@ tilesource_request_tile(Tilesource *tilesource, Tile *tile)
 	printf("  valid = %d\n", valid);
 #endif /*DEBUG_VERBOSE*/
 
-	/* If the tile is not in cache, we must fetch to trigger a bg recomp.
+	/* If it is in cache, the pack pool will fetch the pixels and make a
+	 * texture, and the tile will be collected when that's done.
 	 *
-	 * If it is in cache, we also fetch the pixels and set a texture ready
-	 * for the cache.
-	 */
-	if (vips_region_prepare(tilesource->rgb_region, &hit))
-		return -1;
-
-	/* Do we have new, valid pixels? Update the texture.
+	 * If the tile is not in cache, we must fetch to trigger a bg recomp.
 	 */
 	if (valid)
-		tile_set_texture(tile, tilesource->rgb_region);
+		tilesource_pack(tilesource, tile, &hit);
+	else if (vips_region_prepare(tilesource->rgb_region, &hit))
+		return -1;
 
 	return 0;
 }
@@ -1981,6 +4140,14 @@ tilesource_collect_tile(Tilesource *tilesource, Tile *tile)
 		tile->region->valid.left, tile->region->valid.top);
 #endif /*DEBUG_VERBOSE*/
 
+	/* Collect from the pipeline for this tile's level, but never build one
+	 * just to collect.
+	 */
+	if (!tilesource_has_z(tilesource, tile->z))
+		return 0;
+	if (tilesource_set_z(tilesource, tile->z))
+		return -1;
+
 	/* Clip the tile against the size of this level.
 	 */
 	VipsRect image = { 0, 0,
@@ -1999,14 +4166,11 @@ tilesource_collect_tile(Tilesource *tilesource, Tile *tile)
 #endif /*DEBUG_VERBOSE*/
 
 	/* Only read out the tile if it's valid. We don't want to trigger another
-	 * compute.
+	 * compute. The texture is made in the background and the tile collected
+	 * again when it's ready.
 	 */
-	if (valid) {
-		if (vips_region_prepare(tilesource->rgb_region, &hit))
-			return -1;
-
-		tile_set_texture(tile, tilesource->rgb_region);
-	}
+	if (valid)
+		tilesource_pack(tilesource, tile, &hit);
 
 	return 0;
 }
@@ -2057,3 +4221,72 @@ tilesource_set_synchronous(Tilesource *tilesource, gboolean synchronous)
 		tilesource_update_image(tilesource);
 	}
 }
+
+/* Set the number of bytes the levels of each generated pyramid can cache.
+ * This applies to pyramids made from now on.
+ */
+void
+tilesource_set_pyramid_memory(gsize limit)
+{
+	tilesource_pyramid_memory = limit;
+}
+
+/* Make float tiles for tilesources created from now on.
+ */
+void
+tilesource_set_float_default(gboolean float_tiles)
+{
+	tilesource_float_default = float_tiles;
+}
+
+/* The display settings that are baked into the tiles the current pipeline
+ * makes, so the tilecache can keep tiles for previous settings and switch
+ * back to them. Settings applied by the painter are left as zero.
+ */
+void
+tilesource_get_display(Tilesource *tilesource, TileDisplay *display)
+{
+	memset(display, 0, sizeof(TileDisplay));
+
+	display->mode = tilesource->mode;
+	display->page = tilesource->page;
+	display->active = tilesource->active;
+	display->falsecolour = tilesource->falsecolour;
+	display->icc = tilesource->icc;
+	if (!tilesource->rgb_transfer)
+		display->log = tilesource->log;
+	if (!tilesource->rgb_float &&
+		!tilesource->rgb_transfer) {
+		display->scale = tilesource->rgb_scale;
+		display->offset = tilesource->rgb_offset;
+	}
+}
+
+/* The scale and offset the painter must apply to a tile made with
+ * tile_scale and tile_offset to get the current display, as values in 0 - 1,
+ * and whether the log curve must be applied first, see
+ * tilesource_log_value(). FALSE for no transform.
+ */
+gboolean
+tilesource_get_draw_transform(Tilesource *tilesource,
+	double tile_scale, double tile_offset,
+	double *scale, double *offset, gboolean *log)
+{
+	double current_scale;
+	double current_offset;
+
+	*log = FALSE;
+	if (!tilesource->rgb_linear)
+		return FALSE;
+
+	tilesource_get_linear(tilesource, &current_scale, &current_offset);
+	*scale = current_scale / tile_scale;
+	*offset = (current_offset - *scale * tile_offset) / tilesource->rgb_max;
+	*log = tilesource->rgb_transfer &&
+		tilesource->active &&
+		tilesource->log;
+
+	return *scale != 1.0 ||
+		*offset != 0.0 ||
+		*log;
+}
@@ -153,6 +153,11 @@ typedef struct _Tilesource {
 	const char *loader;
 	char *filename;
 
+	/* If set, display from this tiled pyramidal TIFF in the user cache dir
+	 * instead of @filename. See tilesource_set_pyramid_cache().
+	 */
+	char *cache_filename;
+
 	/* Either the VipsImage we were given to display, or the result of a
 	 * no-param vips_image_new_from_file() on the filename we are displaying.
 	 *
@@ -184,6 +189,10 @@ typedef struct _Tilesource {
 	 */
 	gboolean all_mono;
 
+	/* A tiled TIFF, so we have random access even without a pyramid.
+	 */
+	gboolean tiled;
+
 	/* The pyramid structure in the file. This isn't the same as the pyr of
 	 * the image being displayed -- OME-TIFFs can be multipage and pyr, for
 	 * example.
@@ -240,6 +249,60 @@ typedef struct _Tilesource {
 	VipsImage *rgb;
 	VipsRegion *rgb_region;
 
+	/* Make @rgb a float image in the range 0 - 1 when the display transform
+	 * allows, and leave scale and offset to draw time. rgb_float is set if
+	 * we did, and rgb_max is the image value that maps to 1.
+	 */
+	gboolean float_tiles;
+	gboolean rgb_float;
+	double rgb_max;
+
+	/* rgb_linear is set if scale and offset commute with the rest of the
+	 * pipeline, so tiles can be redrawn with a new scale and offset by the
+	 * painter. rgb_scale and rgb_offset are the values @rgb was built with.
+	 * linear_timeout rebuilds @rgb once the user stops changing them.
+	 */
+	gboolean rgb_linear;
+	double rgb_scale;
+	double rgb_offset;
+	guint linear_timeout;
+
+	/* Set if @rgb is 8-bit mono or RGB with no scale, offset or log, and
+	 * the painter does these with a colour matrix and a transfer curve.
+	 */
+	gboolean rgb_transfer;
+
+	/* Pipelines for z levels other than current_z, most recently used
+	 * first, see TilesourceLevel. All are built with the current display
+	 * settings.
+	 */
+	GSList *levels;
+
+	/* For images with no pyramid, zoomed out levels made from the level
+	 * below by tilesource_pyramid_level(). Locked, since levels are built
+	 * in the background.
+	 */
+	GMutex pyramid_lock;
+	VipsImage *pyramid[MAX_LEVELS];
+
+	/* We load large images without random access ourselves. While they
+	 * load we display @preview, a level0-sized view of the rows decoded so
+	 * far, and only request tiles within the first preview_rows rows.
+	 * Once loaded, @base is the decoded image and @decoded is set, so we
+	 * display from that rather than reopening the file.
+	 * @preview is under pyramid_lock.
+	 */
+	VipsImage *preview;
+	int preview_rows;
+	gboolean decoded;
+
+	/* Pipelines for new levels are built in the background. build_z is the
+	 * level being built, or -1. build_serial is bumped when the display
+	 * settings change, so out of date builds are thrown away.
+	 */
+	int build_z;
+	guint build_serial;
+
 	/* For animations, the timeout we use for page flip.
 	 */
 	guint page_flip_id;
@@ -259,10 +322,21 @@ typedef struct _Tilesource {
 	int load_error;
 	char *load_message;
 
+	/* Set from the main thread to stop a background load, see
+	 * tilesource_cancel_load().
+	 */
+	int load_cancel;
+
 	/* Render priority ... lower for thumbnails.
 	 */
 	int priority;
 
+	/* Tiles computed by bg workers and textures made by the pack pool,
+	 * waiting to be collected. A lock-free stack of TilesourceUpdate, pushed
+	 * by the workers and drained in one go by the main thread.
+	 */
+	gpointer updates;
+
 } Tilesource;
 
 typedef struct _TilesourceClass {
@@ -289,6 +363,15 @@ typedef struct _TilesourceClass {
 	 */
 	void (*collect)(Tilesource *tilesource, VipsRect *area, int z);
 
+	/* The end of a batch of collect signals.
+	 */
+	void (*collect_done)(Tilesource *tilesource);
+
+	/* Scale or offset have changed, but they can be applied at draw time,
+	 * so tiles have not (yet). Just redraw.
+	 */
+	void (*display_changed)(Tilesource *tilesource);
+
 	/* The page has changed. Just for updating the page number display.
 	 */
 	void (*page_changed)(Tilesource *tilesource);
@@ -299,6 +382,16 @@ typedef struct _TilesourceClass {
 	 */
 	void (*loaded)(Tilesource *tilesource);
 
+	/* A pipeline for a new z level has been built in the background.
+	 * Repaint, so tiles for that level get requested from it.
+	 */
+	void (*level_ready)(Tilesource *tilesource);
+
+	/* Rows of a large image have arrived while it loads. Repaint, so
+	 * tiles for those rows get requested.
+	 */
+	void (*rows_ready)(Tilesource *tilesource, VipsRect *area);
+
 } TilesourceClass;
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(Tilesource, g_object_unref)
@@ -306,9 +399,15 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(Tilesource, g_object_unref)
 GType tilesource_get_type(void);
 
 Tilesource *tilesource_new_from_file(const char *filename);
+void tilesource_new_from_file_async(const char *filename,
+	GCancellable *cancellable, GAsyncReadyCallback callback,
+	gpointer user_data);
+Tilesource *tilesource_new_from_file_finish(GAsyncResult *result,
+	GError **error);
 Tilesource *tilesource_new_from_image(VipsImage *image);
 
 void tilesource_background_load(Tilesource *tilesource);
+void tilesource_cancel_load(Tilesource *tilesource);
 
 int tilesource_request_tile(Tilesource *tilesource, Tile *tile);
 int tilesource_collect_tile(Tilesource *tilesource, Tile *tile);
@@ -321,6 +420,19 @@ VipsImage *tilesource_get_base_image(Tilesource *tilesource);
 Tilesource *tilesource_duplicate(Tilesource *tilesource);
 void tilesource_changed(Tilesource *tilesource);
 
+/* Generated pyramids can cache up to this fraction of the tile memory limit.
+ */
+#define TILESOURCE_PYRAMID_FRACTION (4)
+
 void tilesource_set_synchronous(Tilesource *source, gboolean synchronous);
+void tilesource_set_float_default(gboolean float_tiles);
+void tilesource_set_pyramid_memory(gsize limit);
+void tilesource_set_pyramid_cache(gboolean pyramid_cache, int megapixels,
+	int megabytes);
+gboolean tilesource_get_draw_transform(Tilesource *tilesource,
+	double tile_scale, double tile_offset,
+	double *scale, double *offset, gboolean *log);
+double tilesource_log_value(double v);
+void tilesource_get_display(Tilesource *tilesource, TileDisplay *display);
 
 #endif /*__TILESOURCE_H*/
@@ -2,6 +2,10 @@
 
 struct _VipsdispApp {
 	GtkApplication parent;
+
+	/* Process-wide settings, eg. the tile cache size.
+	 */
+	GSettings *settings;
 };
 
 G_DEFINE_TYPE(VipsdispApp, vipsdisp_app, GTK_TYPE_APPLICATION);
@@ -77,6 +81,62 @@ vipsdisp_app_about_activated(GSimpleAction *action,
 		NULL);
 }
 
+static void
+vipsdisp_app_tile_memory_changed(GSettings *settings,
+	const char *key, gpointer user_data)
+{
+	int mb = g_settings_get_int(settings, "tile-memory");
+
+#ifdef DEBUG
+	printf("vipsdisp_app_tile_memory_changed: %d MB\n", mb);
+#endif /*DEBUG*/
+
+	tilecache_set_memory_limit((gsize) mb * 1024 * 1024);
+}
+
+static void
+vipsdisp_app_prefetch_margin_changed(GSettings *settings,
+	const char *key, gpointer user_data)
+{
+	int margin = g_settings_get_int(settings, "prefetch-margin");
+
+#ifdef DEBUG
+	printf("vipsdisp_app_prefetch_margin_changed: %d tiles\n", margin);
+#endif /*DEBUG*/
+
+	tilecache_set_prefetch_margin(margin);
+}
+
+static void
+vipsdisp_app_float_tiles_changed(GSettings *settings,
+	const char *key, gpointer user_data)
+{
+	gboolean float_tiles = g_settings_get_boolean(settings, "float-tiles");
+
+#ifdef DEBUG
+	printf("vipsdisp_app_float_tiles_changed: %d\n", float_tiles);
+#endif /*DEBUG*/
+
+	tilesource_set_float_default(float_tiles);
+}
+
+static void
+vipsdisp_app_pyramid_cache_changed(GSettings *settings,
+	const char *key, gpointer user_data)
+{
+	gboolean pyramid_cache =
+		g_settings_get_boolean(settings, "pyramid-cache");
+	int threshold = g_settings_get_int(settings, "pyramid-cache-threshold");
+	int size = g_settings_get_int(settings, "pyramid-cache-size");
+
+#ifdef DEBUG
+	printf("vipsdisp_app_pyramid_cache_changed: %d, %d megapixels, %d MB\n",
+		pyramid_cache, threshold, size);
+#endif /*DEBUG*/
+
+	tilesource_set_pyramid_cache(pyramid_cache, threshold, size);
+}
+
 static GActionEntry app_entries[] = {
 	{ "quit", vipsdisp_app_quit_activated },
 	{ "new", vipsdisp_app_new_activated },
@@ -131,6 +191,34 @@ vipsdisp_app_startup(GApplication *app)
 		GTK_STYLE_PROVIDER(provider),
 		GTK_STYLE_PROVIDER_PRIORITY_FALLBACK);
 
+	/* All tilecaches share one memory budget and prefetch margin, and
+	 * new tilesources pick up the float tiles and pyramid cache settings.
+	 */
+	VipsdispApp *vipsdisp_app = APP(app);
+	vipsdisp_app->settings = g_settings_new(APPLICATION_ID);
+	g_signal_connect(vipsdisp_app->settings, "changed::tile-memory",
+		G_CALLBACK(vipsdisp_app_tile_memory_changed), app);
+	vipsdisp_app_tile_memory_changed(vipsdisp_app->settings,
+		"tile-memory", app);
+	g_signal_connect(vipsdisp_app->settings, "changed::prefetch-margin",
+		G_CALLBACK(vipsdisp_app_prefetch_margin_changed), app);
+	vipsdisp_app_prefetch_margin_changed(vipsdisp_app->settings,
+		"prefetch-margin", app);
+	g_signal_connect(vipsdisp_app->settings, "changed::float-tiles",
+		G_CALLBACK(vipsdisp_app_float_tiles_changed), app);
+	vipsdisp_app_float_tiles_changed(vipsdisp_app->settings,
+		"float-tiles", app);
+	g_signal_connect(vipsdisp_app->settings, "changed::pyramid-cache",
+		G_CALLBACK(vipsdisp_app_pyramid_cache_changed), app);
+	g_signal_connect(vipsdisp_app->settings,
+		"changed::pyramid-cache-threshold",
+		G_CALLBACK(vipsdisp_app_pyramid_cache_changed), app);
+	g_signal_connect(vipsdisp_app->settings,
+		"changed::pyramid-cache-size",
+		G_CALLBACK(vipsdisp_app_pyramid_cache_changed), app);
+	vipsdisp_app_pyramid_cache_changed(vipsdisp_app->settings,
+		"pyramid-cache", app);
+
 	/* Build our classes.
 	 */
 	IMAGEDISPLAY_TYPE;
@@ -175,6 +263,8 @@ vipsdisp_app_shutdown(GApplication *app)
 	while ((win = vipsdisp_app_win(APP(app))))
 		gtk_window_destroy(GTK_WINDOW(win));
 
+	VIPS_UNREF(APP(app)->settings);
+
 	G_APPLICATION_CLASS(vipsdisp_app_parent_class)->shutdown(app);
 }
 
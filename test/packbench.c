@@ -0,0 +1,112 @@
+/* Benchmark tile_texture_new() for full and edge tiles.
+ */
+
+#include "vipsdisp.h"
+
+/* Pack this many tiles for each case.
+ */
+#define N_TILES (2000)
+
+/* A test image: noise, with @bands bands, as uchar or float. Alpha is
+ * noise too, unless @opaque.
+ */
+static VipsImage *
+make_image(int bands, VipsBandFormat format, gboolean opaque)
+{
+	VipsImage *noise[4] = { NULL };
+	VipsImage *t[3] = { NULL };
+	VipsImage *image = NULL;
+	int failed = 0;
+
+	for (int i = 0; i < bands; i++) {
+		gboolean is_alpha = (bands == 2 || bands == 4) && i == bands - 1;
+
+		failed |= vips_gaussnoise(&noise[i], TILE_SIZE, TILE_SIZE,
+			"mean", opaque && is_alpha ? 255.0 : 128.0,
+			"sigma", opaque && is_alpha ? 0.0 : 64.0,
+			"seed", i,
+			NULL);
+	}
+
+	if (!failed &&
+		!vips_bandjoin(noise, &t[0], bands, NULL) &&
+		!vips_cast(t[0], &t[1], VIPS_FORMAT_UCHAR, NULL)) {
+		if (format == VIPS_FORMAT_FLOAT) {
+			if (!vips_linear1(t[1], &t[2], 1.0 / 255, 0.0, NULL))
+				image = vips_image_copy_memory(t[2]);
+		}
+		else
+			image = vips_image_copy_memory(t[1]);
+	}
+
+	for (int i = 0; i < VIPS_NUMBER(noise); i++)
+		VIPS_UNREF(noise[i]);
+	for (int i = 0; i < VIPS_NUMBER(t); i++)
+		VIPS_UNREF(t[i]);
+
+	if (!image)
+		vips_error_exit("unable to make test image");
+
+	return image;
+}
+
+static void
+bench(const char *name, int bands, VipsBandFormat format, gboolean opaque,
+	int width, int height)
+{
+	VipsImage *image = make_image(bands, format, opaque);
+	VipsRegion *region = vips_region_new(image);
+	VipsRect rect = { 0, 0, width, height };
+
+	if (vips_region_prepare(region, &rect))
+		vips_error_exit("unable to prepare region");
+
+	gint64 start = g_get_monotonic_time();
+
+	for (int i = 0; i < N_TILES; i++) {
+		GdkTexture *texture = tile_texture_new(region);
+
+		g_object_unref(texture);
+	}
+
+	double seconds = (g_get_monotonic_time() - start) / 1000000.0;
+	double bytes = (double) N_TILES *
+		VIPS_REGION_SIZEOF_LINE(region) * height;
+
+	printf("%-12s %3d x %3d: %6.2f GB/s, %6.1f us per tile\n",
+		name, width, height,
+		bytes / seconds / 1e9,
+		seconds * 1e6 / N_TILES);
+
+	g_object_unref(region);
+	g_object_unref(image);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit("unable to start libvips");
+
+	// full tiles come from the buffer pool, edge tiles are one-offs
+	int sizes[][2] = {
+		{ TILE_SIZE, TILE_SIZE },
+		{ 100, 37 },
+	};
+
+	for (int i = 0; i < VIPS_NUMBER(sizes); i++) {
+		int width = sizes[i][0];
+		int height = sizes[i][1];
+
+		bench("mono", 1, VIPS_FORMAT_UCHAR, FALSE, width, height);
+		bench("mono+alpha", 2, VIPS_FORMAT_UCHAR, FALSE, width, height);
+		bench("rgb", 3, VIPS_FORMAT_UCHAR, FALSE, width, height);
+		bench("rgba", 4, VIPS_FORMAT_UCHAR, FALSE, width, height);
+		bench("rgba opaque", 4, VIPS_FORMAT_UCHAR, TRUE, width, height);
+		bench("float rgba", 4, VIPS_FORMAT_FLOAT, FALSE, width, height);
+	}
+
+	vips_shutdown();
+
+	return 0;
+}
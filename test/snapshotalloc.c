@@ -0,0 +1,168 @@
+/* Check that tilecache_update() makes no heap allocations once the tiles it
+ * needs are in cache.
+ *
+ * We interpose malloc and friends and count calls from the main thread
+ * while we update. This needs glibc, see meson.build.
+ */
+
+#include "vipsdisp.h"
+
+/* The viewport we paint, in pixels.
+ */
+#define VIEWPORT (4 * TILE_SIZE)
+
+/* Count allocations over this many frames.
+ */
+#define N_FRAMES (100)
+
+/* Give up waiting for tiles after this many seconds.
+ */
+#define TIMEOUT (60)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread gboolean counting = FALSE;
+static int n_allocs = 0;
+
+void *
+malloc(size_t size)
+{
+	if (counting)
+		n_allocs += 1;
+
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	if (counting)
+		n_allocs += 1;
+
+	return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	if (counting)
+		n_allocs += 1;
+
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+static void
+update(Tilecache *tilecache, double x, double y)
+{
+	graphene_rect_t paint;
+
+	graphene_rect_init(&paint, 0, 0, VIEWPORT, VIEWPORT);
+	tilecache_update(tilecache, 1.0, x, y, &paint);
+}
+
+/* Update at @x, @y until all the tiles we can see have arrived.
+ */
+static void
+fill(Tilecache *tilecache, double x, double y)
+{
+	int n_tiles = (VIEWPORT / TILE_SIZE + 1) * (VIEWPORT / TILE_SIZE + 1);
+	gint64 start = g_get_monotonic_time();
+
+	for (;;) {
+		update(tilecache, x, y);
+		if (tilecache->visible[0]->len >= n_tiles)
+			break;
+
+		while (g_main_context_iteration(NULL, FALSE))
+			;
+		g_usleep(100);
+
+		if (g_get_monotonic_time() - start > TIMEOUT * G_USEC_PER_SEC)
+			vips_error_exit("timeout waiting for tiles");
+	}
+}
+
+/* Count allocations over a set of frames, alternating between two
+ * positions.
+ */
+static int
+count(Tilecache *tilecache, const char *name,
+	double x1, double y1, double x2, double y2)
+{
+	n_allocs = 0;
+	counting = TRUE;
+	for (int i = 0; i < N_FRAMES; i++)
+		if (i & 1)
+			update(tilecache, x2, y2);
+		else
+			update(tilecache, x1, y1);
+	counting = FALSE;
+
+	printf("%-10s %d allocations in %d frames\n", name, n_allocs, N_FRAMES);
+
+	return n_allocs;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit("unable to start libvips");
+
+	VipsImage *black;
+	VipsImage *image;
+	if (vips_black(&black, 8 * TILE_SIZE, 8 * TILE_SIZE, NULL) ||
+		vips_copy(black, &image,
+			"interpretation", VIPS_INTERPRETATION_B_W,
+			NULL))
+		vips_error_exit("unable to make test image");
+	g_object_unref(black);
+
+	Tilesource *tilesource = tilesource_new_from_image(image);
+	if (!tilesource)
+		vips_error_exit("unable to make tilesource");
+	g_object_unref(image);
+	tilesource_background_load(tilesource);
+	while (!tilesource->rgb)
+		g_main_context_iteration(NULL, TRUE);
+
+	// no prefetch, so the steady state is just the tiles in view
+	tilecache_set_prefetch_margin(0);
+
+	Tilecache *tilecache = tilecache_new();
+	g_object_set(tilecache, "tilesource", tilesource, NULL);
+
+	// the viewports we use are offset by half a tile, so they touch 5 x 5
+	// tiles and moving by a tile changes the tile grid
+	double x = TILE_SIZE / 2;
+	double y = TILE_SIZE / 2;
+	fill(tilecache, x, y);
+	fill(tilecache, x + TILE_SIZE, y);
+
+	int failed = 0;
+
+	// the grid doesn't change, so we skip the visibility pass
+	failed |= count(tilecache, "still", x, y, x, y);
+
+	// a small pan inside the same tiles
+	failed |= count(tilecache, "pan", x, y, x + 10, y + 10);
+
+	// move the grid each frame, so we request and find every time
+	failed |= count(tilecache, "scroll", x, y, x + TILE_SIZE, y);
+
+	g_object_unref(tilecache);
+	g_object_unref(tilesource);
+
+	vips_shutdown();
+
+	return failed ? 1 : 0;
+}
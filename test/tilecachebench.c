@@ -0,0 +1,146 @@
+/* Benchmark tilecache frame cost against the number of cached tiles.
+ *
+ * Fill a tilecache with more and more tiles, and at each fill level time
+ * request and collect for new tiles, and find (the visibility pass) for a
+ * viewport that is already cached. None of these should grow with the
+ * number of tiles in the cache.
+ */
+
+#include "vipsdisp.h"
+
+/* The viewport we paint, in pixels. We paint at scale 1, so this is 4 x 4
+ * tiles.
+ */
+#define VIEWPORT (4 * TILE_SIZE)
+
+/* Time this many frames of find at each fill level.
+ */
+#define N_FRAMES (1000)
+
+/* Give up waiting for a viewport after this many seconds.
+ */
+#define TIMEOUT (60)
+
+static void
+paint(Tilecache *tilecache, double x, double y)
+{
+	GtkSnapshot *snapshot = gtk_snapshot_new();
+	graphene_rect_t rect;
+	GskRenderNode *node;
+
+	graphene_rect_init(&rect, 0, 0, VIEWPORT, VIEWPORT);
+	tilecache_snapshot(tilecache, snapshot, 1.0, x, y, &rect, FALSE);
+
+	if ((node = gtk_snapshot_free_to_node(snapshot)))
+		gsk_render_node_unref(node);
+}
+
+/* Paint the viewport at @x, @y until all its tiles have arrived.
+ */
+static void
+fill(Tilecache *tilecache, double x, double y)
+{
+	int n_tiles = (VIEWPORT / TILE_SIZE) * (VIEWPORT / TILE_SIZE);
+	gint64 start = g_get_monotonic_time();
+
+	for (;;) {
+		paint(tilecache, x, y);
+		if (tilecache->visible[0]->len >= n_tiles)
+			break;
+
+		while (g_main_context_iteration(NULL, FALSE))
+			;
+		g_usleep(100);
+
+		if (g_get_monotonic_time() - start > TIMEOUT * G_USEC_PER_SEC)
+			vips_error_exit("timeout waiting for tiles");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit("unable to start libvips");
+
+	/* We need a display for gtk, tell meson to skip us if there isn't one.
+	 */
+	if (!gtk_init_check())
+		return 77;
+
+	// the cache sizes we time at, in tiles
+	int levels[] = { 500, 1000, 2000, 4000, 8000 };
+	int max_tiles = levels[VIPS_NUMBER(levels) - 1];
+
+	// a square grid of tiles big enough to hold the largest cache
+	int across = ceil(sqrt(max_tiles)) + VIEWPORT / TILE_SIZE;
+	int size = across * TILE_SIZE;
+
+	VipsImage *black;
+	VipsImage *image;
+	if (vips_black(&black, size, size, NULL) ||
+		vips_copy(black, &image,
+			"interpretation", VIPS_INTERPRETATION_B_W,
+			NULL))
+		vips_error_exit("unable to make test image");
+	g_object_unref(black);
+
+	Tilesource *tilesource = tilesource_new_from_image(image);
+	if (!tilesource)
+		vips_error_exit("unable to make tilesource");
+	g_object_unref(image);
+	tilesource_background_load(tilesource);
+	while (!tilesource->rgb)
+		g_main_context_iteration(NULL, TRUE);
+
+	// keep every tile, and fetch only what's in view
+	tilecache_set_memory_limit((gsize) 4 * max_tiles * TILE_SIZE * TILE_SIZE);
+	tilecache_set_prefetch_margin(0);
+
+	Tilecache *tilecache = tilecache_new();
+	g_object_set(tilecache, "tilesource", tilesource, NULL);
+
+	printf("%8s %18s %14s\n",
+		"tiles", "request+collect", "find");
+
+	int step = VIEWPORT / TILE_SIZE;
+	int tx = 0;
+	int ty = 0;
+	for (int i = 0; i < VIPS_NUMBER(levels); i++) {
+		int before = g_hash_table_size(tilecache->tiles[0]);
+		gint64 start = g_get_monotonic_time();
+
+		// walk the viewport over the image until the cache is full enough
+		while (g_hash_table_size(tilecache->tiles[0]) < levels[i]) {
+			fill(tilecache, tx * TILE_SIZE, ty * TILE_SIZE);
+
+			tx += step;
+			if (tx + step > across) {
+				tx = 0;
+				ty += step;
+			}
+		}
+
+		int added = g_hash_table_size(tilecache->tiles[0]) - before;
+		double fill_us = (g_get_monotonic_time() - start) /
+			(double) VIPS_MAX(1, added);
+
+		// alternate between two cached viewports, so each frame moves
+		// the tile grid and redoes the visibility pass
+		start = g_get_monotonic_time();
+		for (int j = 0; j < N_FRAMES; j++)
+			paint(tilecache, (j & 1) * TILE_SIZE, 0);
+		double find_us = (g_get_monotonic_time() - start) /
+			(double) N_FRAMES;
+
+		printf("%8d %12.1f us/tile %8.1f us/frame\n",
+			g_hash_table_size(tilecache->tiles[0]), fill_us, find_us);
+	}
+
+	g_object_unref(tilecache);
+	g_object_unref(tilesource);
+
+	vips_shutdown();
+
+	return 0;
+}